@@ -0,0 +1,610 @@
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "api.h"
+
+// Microbenchmarks
+// Every workload runs against a buddy heap, a slab heap and the system malloc and reports
+// ops/sec (one malloc or one free is one op), p50/p99/p999 latency and peak footprint.
+
+#define ARENA_SIZE (64 * 1024 * 1024)
+#define HEADER_SIZE 8
+#define MIN_MEM_CHUNK_SIZE 64
+#define N_OBJS_PER_SLAB 64
+#define SLAB_SIZE_CLASS_STEPS 4     // mixed sizes would make one cache per size without it
+#define SLAB_KEEP_EMPTY 2           // empty slabs per cache kept, churn would remake them otherwise
+
+#define LIVE_SLOTS 4096             // objects a workload keeps around at once
+#define LAT_EVERY 16                // time one op out of this many, the clock costs as much as an op
+#define FOOTPRINT_EVERY 256         // ops between footprint samples, taken off the clock
+#define LARSON_THREADS 4
+#define LARSON_ROUNDS 16
+#define PC_RING 1024                // objects in flight between one producer and its consumer
+#define CHASE_NODES (256 * 1024)    // list nodes of the pointer chase, far more than the caches hold
+
+enum backend_kind { BACKEND_BUDDY, BACKEND_SLAB, BACKEND_HYBRID, BACKEND_SYSTEM };
+
+typedef struct backend {
+    const char *name;
+    enum backend_kind kind;
+    allocator_t *heap;  // NULL for the system malloc
+    void *ram;
+} backend_t;
+
+typedef struct run {
+    backend_t *b;
+    uint64_t ops;
+    uint64_t failures;
+    uint64_t *lat;      // sampled latencies in ns
+    size_t nlat, cap;
+    size_t peak;        // footprint high water mark in bytes
+    uint64_t paused;    // ns spent sampling the footprint, not counted in ops/sec
+    uint64_t rng;
+} run_t;
+
+typedef struct workload {
+    const char *name;
+    void (*fn)(run_t *r, uint64_t nops);
+    bool threaded;      // needs a thread safe heap
+} workload_t;
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t next_rand(uint64_t *s) {
+    // xorshift64*, the same sequence for every backend
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ull;
+}
+
+// Sizes between 16 and 4096, small ones much more likely (about log-uniform)
+static inline int random_size(uint64_t *s) {
+    int shift = 4 + (int)(next_rand(s) % 9);
+    int lo = 1 << shift;
+    return lo + (int)(next_rand(s) % (uint64_t)lo) / 2;
+}
+
+static size_t footprint(backend_t *b) {
+    if (b->kind == BACKEND_SYSTEM) {
+        struct mallinfo2 mi = mallinfo2();
+        return mi.arena + mi.hblkhd;
+    }
+    return alloc_footprint(b->heap);
+}
+
+static void lat_push(run_t *r, uint64_t ns) {
+    if (r->nlat == r->cap) {
+        r->cap = r->cap ? r->cap * 2 : 4096;
+        r->lat = realloc(r->lat, r->cap * sizeof(uint64_t));
+        if (r->lat == NULL) {
+            perror("realloc() error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    r->lat[r->nlat++] = ns;
+}
+
+static void note_op(run_t *r) {
+    r->ops++;
+    if (r->ops % FOOTPRINT_EVERY == LAT_EVERY / 2) {
+        // mallinfo2() and the heap lock still cost more than an op; halfway between two timed
+        // ops, so neither shows in the latencies
+        uint64_t t0 = now_ns();
+        size_t f = footprint(r->b);
+        if (f > r->peak)
+            r->peak = f;
+        r->paused += now_ns() - t0;
+    }
+}
+
+static void *bench_malloc(run_t *r, int size) {
+    backend_t *b = r->b;
+    bool timed = r->ops % LAT_EVERY == 0;
+    uint64_t t0 = timed ? now_ns() : 0;
+    void *p = b->heap ? alloc_malloc(b->heap, size) : malloc(size);
+    if (timed)
+        lat_push(r, now_ns() - t0);
+    if (p == NULL)
+        r->failures++;
+    else
+        memset(p, 0xA5, size < 64 ? size : 64);   // touch it like a real caller would
+    note_op(r);
+    return p;
+}
+
+static void bench_free(run_t *r, void *p) {
+    if (p == NULL)
+        return;
+    backend_t *b = r->b;
+    bool timed = r->ops % LAT_EVERY == 0;
+    uint64_t t0 = timed ? now_ns() : 0;
+    if (b->heap)
+        alloc_free(b->heap, p);
+    else
+        free(p);
+    if (timed)
+        lat_push(r, now_ns() - t0);
+    note_op(r);
+}
+
+// Workloads
+
+// One size, free the oldest object every time the ring is full
+static void wl_fixed_churn(run_t *r, uint64_t nops) {
+    void *slots[LIVE_SLOTS] = {0};
+    for (uint64_t i = 0; r->ops < nops; i++) {
+        void **s = &slots[i % LIVE_SLOTS];
+        bench_free(r, *s);
+        *s = bench_malloc(r, 64);
+    }
+    for (int i = 0; i < LIVE_SLOTS; i++)
+        bench_free(r, slots[i]);
+}
+
+// Random sizes, replace a random live object
+static void wl_random_mix(run_t *r, uint64_t nops) {
+    void *slots[LIVE_SLOTS] = {0};
+    while (r->ops < nops) {
+        void **s = &slots[next_rand(&r->rng) % LIVE_SLOTS];
+        bench_free(r, *s);
+        *s = bench_malloc(r, random_size(&r->rng));
+    }
+    for (int i = 0; i < LIVE_SLOTS; i++)
+        bench_free(r, slots[i]);
+}
+
+// Fill up, then free in reverse (stack) order
+static void wl_lifo(run_t *r, uint64_t nops) {
+    void *slots[LIVE_SLOTS];
+    while (r->ops < nops) {
+        for (int i = 0; i < LIVE_SLOTS; i++)
+            slots[i] = bench_malloc(r, random_size(&r->rng));
+        for (int i = LIVE_SLOTS - 1; i >= 0; i--)
+            bench_free(r, slots[i]);
+    }
+}
+
+// Fill up, then free in allocation (queue) order
+static void wl_fifo(run_t *r, uint64_t nops) {
+    void *slots[LIVE_SLOTS];
+    while (r->ops < nops) {
+        for (int i = 0; i < LIVE_SLOTS; i++)
+            slots[i] = bench_malloc(r, random_size(&r->rng));
+        for (int i = 0; i < LIVE_SLOTS; i++)
+            bench_free(r, slots[i]);
+    }
+}
+
+// Mostly small objects with a big buffer (64 KB to 256 KB) now and then
+static void wl_big_mix(run_t *r, uint64_t nops) {
+    void *slots[LIVE_SLOTS / 4] = {0};
+    while (r->ops < nops) {
+        void **s = &slots[next_rand(&r->rng) % (LIVE_SLOTS / 4)];
+        bench_free(r, *s);
+        int size = next_rand(&r->rng) % 64 ? random_size(&r->rng) : 65536 + (int)(next_rand(&r->rng) % 196608);
+        *s = bench_malloc(r, size);
+    }
+    for (int i = 0; i < LIVE_SLOTS / 4; i++)
+        bench_free(r, slots[i]);
+}
+
+// A few long lived objects pinned between many short lived ones, the classic fragmenter
+static void wl_long_short(run_t *r, uint64_t nops) {
+    void *keep[LIVE_SLOTS / 4];
+    int nkeep = 0;
+    void *tmp[64];
+    while (r->ops < nops) {
+        for (int i = 0; i < 64; i++)
+            tmp[i] = bench_malloc(r, random_size(&r->rng));
+        if (nkeep < LIVE_SLOTS / 4)
+            keep[nkeep++] = bench_malloc(r, random_size(&r->rng));
+        for (int i = 0; i < 64; i++)
+            bench_free(r, tmp[i]);
+    }
+    for (int i = 0; i < nkeep; i++)
+        bench_free(r, keep[i]);
+}
+
+// Larson style: every thread replaces random objects in a slot array, and between rounds the
+// arrays move on to the next thread, so most frees hit objects another thread allocated
+typedef struct larson {
+    run_t run;
+    int id;
+    uint64_t nops;
+    void ***arrays;
+    pthread_barrier_t *barrier;
+} larson_t;
+
+static void *larson_thread(void *arg) {
+    larson_t *l = (larson_t *)arg;
+    run_t *r = &l->run;
+    uint64_t per_round = l->nops / LARSON_THREADS / LARSON_ROUNDS;
+    for (int round = 0; round < LARSON_ROUNDS; round++) {
+        void **slots = l->arrays[(l->id + round) % LARSON_THREADS];
+        for (uint64_t i = 0; i < per_round; i += 2) {
+            void **s = &slots[next_rand(&r->rng) % LIVE_SLOTS];
+            bench_free(r, *s);
+            *s = bench_malloc(r, random_size(&r->rng));
+        }
+        pthread_barrier_wait(l->barrier);
+    }
+    return NULL;
+}
+
+static void wl_larson(run_t *r, uint64_t nops) {
+    void **arrays[LARSON_THREADS];
+    larson_t l[LARSON_THREADS];
+    pthread_t tid[LARSON_THREADS];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, LARSON_THREADS);
+    uint64_t paused = 0;
+
+    for (int t = 0; t < LARSON_THREADS; t++) {
+        arrays[t] = calloc(LIVE_SLOTS, sizeof(void *));
+        if (arrays[t] == NULL) {
+            perror("calloc() error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < LARSON_THREADS; t++) {
+        l[t] = (larson_t){.id = t, .nops = nops, .arrays = arrays, .barrier = &barrier};
+        l[t].run.b = r->b;
+        l[t].run.rng = r->rng + (uint64_t)t * 0x9E3779B97F4A7C15ull;
+        pthread_create(&tid[t], NULL, larson_thread, &l[t]);
+    }
+
+    // merge the per thread results into the caller's run
+    for (int t = 0; t < LARSON_THREADS; t++) {
+        pthread_join(tid[t], NULL);
+        run_t *tr = &l[t].run;
+        r->ops += tr->ops;
+        r->failures += tr->failures;
+        if (tr->peak > r->peak)
+            r->peak = tr->peak;
+        if (tr->paused > paused)
+            paused = tr->paused;        // the threads sampled side by side
+        for (size_t i = 0; i < tr->nlat; i++)
+            lat_push(r, tr->lat[i]);
+        free(tr->lat);
+    }
+    r->paused += paused;
+    for (int t = 0; t < LARSON_THREADS; t++) {
+        for (int i = 0; i < LIVE_SLOTS; i++)
+            bench_free(r, arrays[t][i]);
+        free(arrays[t]);
+    }
+    pthread_barrier_destroy(&barrier);
+}
+
+// Producer/consumer pairs: producers only allocate, consumers only free what their producer
+// handed over through a ring, so every free is a cross-thread free. 1, 2 and 4 pairs show
+// how the remote free path scales with the thread count
+typedef struct pc_ring {
+    void *slots[PC_RING];
+    uint64_t head;      // next slot the producer fills
+    uint64_t tail;      // next slot the consumer empties
+} pc_ring_t;
+
+typedef struct pc_thread {
+    run_t run;
+    uint64_t nops;
+    pc_ring_t *ring;
+} pc_thread_t;
+
+static void *producer_thread(void *arg) {
+    pc_thread_t *p = (pc_thread_t *)arg;
+    pc_ring_t *ring = p->ring;
+    for (uint64_t i = 0; i < p->nops; i++) {
+        void *obj = bench_malloc(&p->run, random_size(&p->run.rng));
+        while (i - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= PC_RING)
+            sched_yield();
+        ring->slots[i % PC_RING] = obj;
+        __atomic_store_n(&ring->head, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void *consumer_thread(void *arg) {
+    pc_thread_t *c = (pc_thread_t *)arg;
+    pc_ring_t *ring = c->ring;
+    for (uint64_t i = 0; i < c->nops; i++) {
+        while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) <= i)
+            sched_yield();
+        void *obj = ring->slots[i % PC_RING];
+        __atomic_store_n(&ring->tail, i + 1, __ATOMIC_RELEASE);
+        bench_free(&c->run, obj);
+    }
+    return NULL;
+}
+
+static void prodcons(run_t *r, uint64_t nops, int pairs) {
+    pc_ring_t *rings = calloc((size_t)pairs, sizeof(pc_ring_t));
+    pc_thread_t *t = calloc((size_t)pairs * 2, sizeof(pc_thread_t));
+    pthread_t *tid = calloc((size_t)pairs * 2, sizeof(pthread_t));
+    uint64_t paused = 0;
+    if (rings == NULL || t == NULL || tid == NULL) {
+        perror("calloc() error");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < pairs * 2; i++) {
+        t[i].run.b = r->b;
+        t[i].run.rng = r->rng + (uint64_t)i * 0x9E3779B97F4A7C15ull;
+        t[i].nops = nops / 2 / (uint64_t)pairs;       // one malloc and one free per object
+        t[i].ring = &rings[i / 2];
+        pthread_create(&tid[i], NULL, i % 2 ? consumer_thread : producer_thread, &t[i]);
+    }
+    for (int i = 0; i < pairs * 2; i++) {
+        pthread_join(tid[i], NULL);
+        run_t *tr = &t[i].run;
+        r->ops += tr->ops;
+        r->failures += tr->failures;
+        if (tr->peak > r->peak)
+            r->peak = tr->peak;
+        if (tr->paused > paused)
+            paused = tr->paused;        // the threads sampled side by side
+        for (size_t j = 0; j < tr->nlat; j++)
+            lat_push(r, tr->lat[j]);
+        free(tr->lat);
+    }
+    r->paused += paused;
+    free(tid);
+    free(t);
+    free(rings);
+}
+
+static void wl_prodcons_1(run_t *r, uint64_t nops) { prodcons(r, nops, 1); }
+static void wl_prodcons_2(run_t *r, uint64_t nops) { prodcons(r, nops, 2); }
+static void wl_prodcons_4(run_t *r, uint64_t nops) { prodcons(r, nops, 4); }
+
+static const workload_t workloads[] = {
+    {"fixed-churn", wl_fixed_churn, false},
+    {"random-mix", wl_random_mix, false},
+    {"lifo", wl_lifo, false},
+    {"fifo", wl_fifo, false},
+    {"long-short", wl_long_short, false},
+    {"big-mix", wl_big_mix, false},
+    {"larson", wl_larson, true},
+    {"prodcons-1", wl_prodcons_1, true},
+    {"prodcons-2", wl_prodcons_2, true},
+    {"prodcons-4", wl_prodcons_4, true},
+};
+
+// Backends
+
+static void backend_open(backend_t *b, enum backend_kind kind, unsigned flags) {
+    static const char *names[] = {"buddy", "slab", "hybrid", "system"};
+    static const enum malloc_type types[] = {MALLOC_BUDDY, MALLOC_SLAB, MALLOC_HYBRID};
+    memset(b, 0, sizeof(*b));
+    b->kind = kind;
+    b->name = names[kind];
+    if (kind == BACKEND_SYSTEM)
+        return;
+
+    b->ram = malloc(ARENA_SIZE);
+    if (b->ram == NULL) {
+        perror("malloc() error");
+        exit(EXIT_FAILURE);
+    }
+    alloc_config_t config = {
+        .type = types[kind],
+        .memory_size = ARENA_SIZE,
+        .start_of_memory = b->ram,
+        .header_size = HEADER_SIZE,
+        .min_mem_chunk_size = MIN_MEM_CHUNK_SIZE,
+        .n_objs_per_slab = N_OBJS_PER_SLAB,
+        .flags = flags,
+        .size_class_steps = SLAB_SIZE_CLASS_STEPS,
+        .slab_keep_empty = SLAB_KEEP_EMPTY,
+    };
+    b->heap = alloc_create(&config);
+    if (b->heap == NULL) {
+        fprintf(stderr, "alloc_create() failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void backend_close(backend_t *b) {
+    if (b->heap)
+        alloc_destroy(b->heap);
+    free(b->ram);
+}
+
+static int cmp_u64(const void *x, const void *y) {
+    uint64_t a = *(const uint64_t *)x, b = *(const uint64_t *)y;
+    return a < b ? -1 : a > b;
+}
+
+static uint64_t percentile(run_t *r, double p) {
+    if (r->nlat == 0)
+        return 0;
+    size_t i = (size_t)(p * (double)(r->nlat - 1));
+    return r->lat[i];
+}
+
+static void run_one(const workload_t *w, enum backend_kind kind, uint64_t nops) {
+    // own process per run, so neither footprint nor warm caches leak into the next run
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork() error");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    backend_t b;
+    backend_open(&b, kind, w->threaded ? MALLOC_F_THREADSAFE : 0);
+    run_t r = {.b = &b, .rng = 0x2545F4914F6CDD1Dull};
+    size_t base = kind == BACKEND_SYSTEM ? footprint(&b) : 0;
+
+    uint64_t t0 = now_ns();
+    w->fn(&r, nops);
+    double secs = (double)(now_ns() - t0 - r.paused) / 1e9;
+
+    size_t f = footprint(&b);
+    if (f > r.peak)
+        r.peak = f;
+    r.peak = r.peak > base ? r.peak - base : 0;
+    qsort(r.lat, r.nlat, sizeof(uint64_t), cmp_u64);
+    printf("%-12s %-7s %12.0f %8llu %8llu %8llu %10zu %8llu\n",
+           w->name, b.name, (double)r.ops / secs,
+           (unsigned long long)percentile(&r, 0.50), (unsigned long long)percentile(&r, 0.99),
+           (unsigned long long)percentile(&r, 0.999), r.peak / 1024, (unsigned long long)r.failures);
+    fflush(stdout);
+
+    free(r.lat);
+    backend_close(&b);
+    exit(EXIT_SUCCESS);
+}
+
+// Pointer chase: a list of fixed-size nodes linked in random order, walked end to end. Every
+// hop reads the first and the last word of a node, so a node that straddles two cache lines
+// costs two misses. Run against the slab heap with the packed and the line aware layout
+// (MALLOC_F_SLAB_ALIGN); misses come from the hardware counter when the kernel lets us have it
+
+static volatile uint64_t chase_sink;    // keeps the walk from being optimized away
+
+static int miss_counter_open(void) {
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CACHE_MISSES;
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+} // -1 when there is no such counter (VMs, perf_event_paranoid)
+
+static void chase_one(unsigned flags, int size, uint64_t walks) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork() error");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    backend_t b;
+    backend_open(&b, BACKEND_SLAB, flags);
+    void **nodes = malloc(CHASE_NODES * sizeof(void *));
+    if (nodes == NULL) {
+        perror("malloc() error");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t rng = 0x2545F4914F6CDD1Dull, lines = 0;
+    for (int i = 0; i < CHASE_NODES; i++) {
+        nodes[i] = alloc_malloc(b.heap, size);
+        if (nodes[i] == NULL) {
+            fprintf(stderr, "chase: out of memory after %d nodes\n", i);
+            exit(EXIT_FAILURE);
+        }
+        memset(nodes[i], 0, size);
+        uintptr_t p = (uintptr_t)nodes[i];
+        lines += (p + size - 1) / 64 - p / 64 + 1;
+    }
+    for (int i = CHASE_NODES - 1; i > 0; i--) {      // shuffle, then link in that order
+        int j = (int)(next_rand(&rng) % (uint64_t)(i + 1));
+        void *t = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = t;
+    }
+    for (int i = 0; i < CHASE_NODES; i++)
+        *(void **)nodes[i] = nodes[(i + 1) % CHASE_NODES];
+
+    int fd = miss_counter_open();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t t0 = now_ns(), sum = 0;
+    void *p = nodes[0];
+    for (uint64_t hop = 0; hop < walks * CHASE_NODES; hop++) {
+        uint64_t last;
+        memcpy(&last, (char *)p + size - sizeof(last), sizeof(last));
+        sum += last;
+        p = *(void **)p;
+    }
+    uint64_t ns = now_ns() - t0;
+    chase_sink = sum;
+    long long misses = -1;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+            misses = -1;
+        close(fd);
+    }
+
+    double hops = (double)(walks * CHASE_NODES);
+    char miss_rate[32] = "n/a";
+    if (misses >= 0)
+        snprintf(miss_rate, sizeof(miss_rate), "%.3f", (double)misses / hops);
+    printf("%-12d %-7s %10.2f %10.3f %10s %10zu\n", size, flags & MALLOC_F_SLAB_ALIGN ? "aligned" : "packed",
+           (double)ns / hops, (double)lines / CHASE_NODES, miss_rate, footprint(&b) / 1024);
+    fflush(stdout);
+
+    free(nodes);
+    backend_close(&b);
+    exit(EXIT_SUCCESS);
+}
+
+static void run_chase(uint64_t nops) {
+    static const int sizes[] = {24, 40, 48, 56, 100};
+    uint64_t walks = nops / CHASE_NODES ? nops / CHASE_NODES : 1;
+    printf("\n%-12s %-7s %10s %10s %10s %10s\n", "chase size", "layout", "ns/hop", "lines/node", "misses/hop", "peak KB");
+    fflush(stdout);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        chase_one(0, sizes[i], walks);
+        chase_one(MALLOC_F_SLAB_ALIGN, sizes[i], walks);
+    }
+}
+
+// Usage: bench [ops per run] [workload name]
+int main(int argc, char *argv[]) {
+    uint64_t nops = 2000000;
+    const char *only = NULL;
+    if (argc > 1)
+        nops = strtoull(argv[1], NULL, 10);
+    if (argc > 2)
+        only = argv[2];
+    if (nops == 0) {
+        fprintf(stderr, "Usage: %s [ops per run] [workload]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-12s %-7s %12s %8s %8s %8s %10s %8s\n",
+           "workload", "alloc", "ops/s", "p50 ns", "p99 ns", "p999 ns", "peak KB", "fails");
+    fflush(stdout);
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        if (only && strcmp(only, workloads[i].name) != 0)
+            continue;
+        run_one(&workloads[i], BACKEND_BUDDY, nops);
+        run_one(&workloads[i], BACKEND_SLAB, nops);
+        run_one(&workloads[i], BACKEND_HYBRID, nops);
+        run_one(&workloads[i], BACKEND_SYSTEM, nops);
+    }
+    if (only == NULL || strcmp(only, "chase") == 0)
+        run_chase(nops);
+    return 0;
+}
@@ -0,0 +1,296 @@
+#include <time.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "adapters.hpp"
+
+// Compile time configuration against the C path
+// Both sides get the same heap config: the C side calls alloc_malloc()/alloc_free() on a heap
+// made by alloc_create(), the C++ side Allocator<...>::allocate()/deallocate(). Every run first
+// replays its op sequence on fresh heaps of both kinds and checks each block lands at the same
+// offset, then times both, best of REPEATS runs each. The fixed size workload passes a constant
+// at the call site, so the C++ side folds the class lookup away; the mixed one draws sizes from
+// a small table.
+// The container workloads run std::map, std::list and std::unordered_map with the default
+// allocator, with StlAllocator over buddy, slab and hybrid heaps, and as std::pmr containers
+// over new/delete and over MemoryResource on a slab heap. Every node goes back through the
+// sized deallocate, so this is also the path alloc_free_sized() takes.
+
+#define ARENA_SIZE (64 * 1024 * 1024)
+#define HEADER_SIZE 8
+#define MIN_MEM_CHUNK_SIZE 64
+#define N_OBJS_PER_SLAB 64
+#define SLAB_SIZE_CLASS_STEPS 4
+#define LIVE_SLOTS 4096             // objects a workload keeps around at once
+#define REPEATS 5                   // timed runs per side, alternating, the best one counts
+#define CONTAINER_KEYS 16384        // key range of the container workloads, about half of it is live
+
+using liballocator::Allocator;
+using BuddyHeap = Allocator<MIN_MEM_CHUNK_SIZE, HEADER_SIZE, N_OBJS_PER_SLAB, MALLOC_BUDDY, SLAB_SIZE_CLASS_STEPS>;
+using SlabHeap = Allocator<MIN_MEM_CHUNK_SIZE, HEADER_SIZE, N_OBJS_PER_SLAB, MALLOC_SLAB, SLAB_SIZE_CLASS_STEPS>;
+using HybridHeap = Allocator<MIN_MEM_CHUNK_SIZE, HEADER_SIZE, N_OBJS_PER_SLAB, MALLOC_HYBRID, SLAB_SIZE_CLASS_STEPS>;
+using liballocator::MemoryResource;
+using liballocator::StlAllocator;
+
+static const size_t mixed_sizes[] = {16, 24, 40, 64, 100, 200, 500, 1000};
+
+static inline uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t next_rand(uint64_t *s) {
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ull;
+}
+
+// the C path with the same interface as Allocator
+struct CHeap {
+    allocator_t *h;
+    CHeap(enum malloc_type type, void *ram) {
+        alloc_config_t config = {};
+        config.type = type;
+        config.memory_size = ARENA_SIZE;
+        config.start_of_memory = ram;
+        config.header_size = HEADER_SIZE;
+        config.min_mem_chunk_size = MIN_MEM_CHUNK_SIZE;
+        config.n_objs_per_slab = N_OBJS_PER_SLAB;
+        config.size_class_steps = SLAB_SIZE_CLASS_STEPS;
+        h = alloc_create(&config);
+        if (h == NULL) {
+            fprintf(stderr, "alloc_create() failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ~CHeap() { alloc_destroy(h); }
+    void *allocate(size_t size) { return alloc_malloc(h, size); }
+    void deallocate(void *p) { alloc_free(h, p); }
+};
+
+// one malloc or one free is one op; offsets != NULL records where every block went
+template <bool Fixed, class Heap>
+static uint64_t churn(Heap &heap, uint64_t nops, const char *base, std::vector<size_t> *offsets) {
+    static void *slots[LIVE_SLOTS];
+    memset(slots, 0, sizeof(slots));
+    uint64_t rng = 0x2545F4914F6CDD1Dull, ops = 0;
+    while (ops < nops) {
+        uint64_t r = next_rand(&rng);
+        void *&slot = slots[r % LIVE_SLOTS];
+        if (slot) {
+            heap.deallocate(slot);
+            slot = NULL;
+            ops++;
+        }
+        slot = Fixed ? heap.allocate(48) : heap.allocate(mixed_sizes[(r >> 32) % 8]);
+        ops++;
+        if (offsets)
+            offsets->push_back(slot ? (size_t)((const char *)slot - base) : SIZE_MAX);
+    }
+    for (void *p : slots)
+        heap.deallocate(p);
+    return ops;
+}
+
+template <bool Fixed, class Heap>
+static void run(const char *workload, const char *name, enum malloc_type type, uint64_t nops) {
+    char *ram_c = (char *)malloc(ARENA_SIZE), *ram_cpp = (char *)malloc(ARENA_SIZE);
+    if (ram_c == NULL || ram_cpp == NULL) {
+        perror("malloc() error");
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<size_t> want, got;
+    {
+        CHeap c(type, ram_c);
+        Heap cpp(ram_cpp, ARENA_SIZE);
+        churn<Fixed>(c, nops, ram_c, &want);
+        churn<Fixed>(cpp, nops, ram_cpp, &got);
+    }
+    bool same = want == got;
+
+    double ns_c = 1e30, ns_cpp = 1e30;
+    for (int rep = 0; rep < REPEATS; rep++) {
+        {
+            CHeap c(type, ram_c);
+            uint64_t t0 = now_ns();
+            uint64_t ops = churn<Fixed>(c, nops, ram_c, NULL);
+            double ns = (double)(now_ns() - t0) / (double)ops;
+            if (ns < ns_c)
+                ns_c = ns;
+        }
+        {
+            Heap cpp(ram_cpp, ARENA_SIZE);
+            uint64_t t0 = now_ns();
+            uint64_t ops = churn<Fixed>(cpp, nops, ram_cpp, NULL);
+            double ns = (double)(now_ns() - t0) / (double)ops;
+            if (ns < ns_cpp)
+                ns_cpp = ns;
+        }
+    }
+    printf("%-10s %-7s %10.1f %10.1f %8.2fx %6s\n", workload, name, ns_c, ns_cpp, ns_c / ns_cpp, same ? "yes" : "NO");
+    fflush(stdout);
+    free(ram_c);
+    free(ram_cpp);
+}
+
+// Node heavy containers
+// One op is one container operation; each allocates or frees about one node.
+using Pair = std::pair<const uint64_t, uint64_t>;
+
+template <class Alloc>
+using Map = std::map<uint64_t, uint64_t, std::less<uint64_t>, typename std::allocator_traits<Alloc>::template rebind_alloc<Pair>>;
+template <class Alloc>
+using UnorderedMap = std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                                        typename std::allocator_traits<Alloc>::template rebind_alloc<Pair>>;
+template <class Alloc>
+using List = std::list<uint64_t, typename std::allocator_traits<Alloc>::template rebind_alloc<uint64_t>>;
+
+static uint64_t sink;               // keeps the container work from being optimized away
+
+template <class C>
+static void map_churn(C &c, uint64_t nops) {
+    // look a random key up, erase it when it is there, insert it otherwise
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+    for (uint64_t i = 0; i < nops; i++) {
+        uint64_t key = next_rand(&rng) % CONTAINER_KEYS;
+        auto it = c.find(key);
+        if (it != c.end()) {
+            sink += it->second;
+            c.erase(it);
+        } else {
+            c.emplace(key, i);
+        }
+    }
+}
+
+template <class C>
+static void unordered_map_churn(C &c, uint64_t nops) {
+    c.reserve(CONTAINER_KEYS);      // one bucket array, the nodes are what churns
+    map_churn(c, nops);
+}
+
+template <class C>
+static void list_churn(C &c, uint64_t nops) {
+    // a deque of nodes that grows and shrinks at random ends, up to half the key range
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+    for (uint64_t i = 0; i < nops; i++) {
+        uint64_t r = next_rand(&rng);
+        if (c.empty() || (c.size() < CONTAINER_KEYS / 2 && (r & 1))) {
+            if (r & 2) c.push_front(i);
+            else c.push_back(i);
+        } else if (r & 4) {
+            sink += c.front();
+            c.pop_front();
+        } else {
+            sink += c.back();
+            c.pop_back();
+        }
+    }
+}
+
+template <template <class> class Container, class Churn, class Alloc>
+static double time_container(Churn churn, const Alloc &alloc, uint64_t nops) {
+    // the container is made, churned and destroyed inside the timed part
+    uint64_t t0 = now_ns();
+    {
+        Container<Alloc> c(alloc);
+        churn(c, nops);
+    }
+    return (double)(now_ns() - t0) / (double)nops;
+}
+
+template <template <class> class Container, class Churn>
+static void run_container(const char *workload, Churn churn, uint64_t nops) {
+    enum { STD, BUDDY, SLAB, HYBRID, PMR_STD, PMR_SLAB, KINDS };
+    static const char *names[KINDS] = {"std", "buddy", "slab", "hybrid", "pmr-std", "pmr-slab"};
+    char *ram = (char *)aligned_alloc(4096, ARENA_SIZE);
+    if (ram == NULL) {
+        perror("aligned_alloc() error");
+        exit(EXIT_FAILURE);
+    }
+
+    double best[KINDS];
+    for (int k = 0; k < KINDS; k++)
+        best[k] = 1e30;
+    for (int rep = 0; rep < REPEATS; rep++) {
+        for (int k = 0; k < KINDS; k++) {
+            double ns = 0;
+            if (k == STD) {
+                ns = time_container<Container>(churn, std::allocator<char>(), nops);
+            } else if (k == BUDDY) {
+                BuddyHeap heap(ram, ARENA_SIZE);
+                ns = time_container<Container>(churn, StlAllocator<char, BuddyHeap>(heap), nops);
+            } else if (k == SLAB) {
+                SlabHeap heap(ram, ARENA_SIZE);
+                ns = time_container<Container>(churn, StlAllocator<char, SlabHeap>(heap), nops);
+            } else if (k == HYBRID) {
+                HybridHeap heap(ram, ARENA_SIZE);
+                ns = time_container<Container>(churn, StlAllocator<char, HybridHeap>(heap), nops);
+            } else if (k == PMR_STD) {
+                ns = time_container<Container>(churn, std::pmr::polymorphic_allocator<char>(std::pmr::new_delete_resource()), nops);
+            } else {
+                SlabHeap heap(ram, ARENA_SIZE);
+                MemoryResource<SlabHeap> resource(heap);
+                ns = time_container<Container>(churn, std::pmr::polymorphic_allocator<char>(&resource), nops);
+            }
+            if (ns < best[k])
+                best[k] = ns;
+        }
+    }
+    for (int k = 0; k < KINDS; k++)
+        printf("%-14s %-9s %10.1f %9.2fx\n", workload, names[k], best[k], best[STD] / best[k]);
+    fflush(stdout);
+    free(ram);
+}
+
+static bool selected(const char *only, const char *workload) {
+    return only == NULL || strcmp(only, workload) == 0;
+}
+
+// Usage: bench_cpp [ops per run] [workload]
+int main(int argc, char *argv[]) {
+    uint64_t nops = 2000000;
+    const char *only = NULL;
+    if (argc > 1)
+        nops = strtoull(argv[1], NULL, 10);
+    if (argc > 2)
+        only = argv[2];
+    if (nops == 0) {
+        fprintf(stderr, "Usage: %s [ops per run] [workload]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (selected(only, "fixed-48") || selected(only, "mixed"))
+        printf("%-10s %-7s %10s %10s %9s %6s\n", "workload", "alloc", "C ns/op", "C++ ns/op", "speedup", "same");
+    if (selected(only, "fixed-48")) {
+        run<true, BuddyHeap>("fixed-48", "buddy", MALLOC_BUDDY, nops);
+        run<true, SlabHeap>("fixed-48", "slab", MALLOC_SLAB, nops);
+        run<true, HybridHeap>("fixed-48", "hybrid", MALLOC_HYBRID, nops);
+    }
+    if (selected(only, "mixed")) {
+        run<false, BuddyHeap>("mixed", "buddy", MALLOC_BUDDY, nops);
+        run<false, SlabHeap>("mixed", "slab", MALLOC_SLAB, nops);
+        run<false, HybridHeap>("mixed", "hybrid", MALLOC_HYBRID, nops);
+    }
+
+    if (selected(only, "map") || selected(only, "list") || selected(only, "unordered_map"))
+        printf("%-14s %-9s %10s %10s\n", "container", "alloc", "ns/op", "vs std");
+    if (selected(only, "map"))
+        run_container<Map>("map", [](auto &c, uint64_t n) { map_churn(c, n); }, nops);
+    if (selected(only, "list"))
+        run_container<List>("list", [](auto &c, uint64_t n) { list_churn(c, n); }, nops);
+    if (selected(only, "unordered_map"))
+        run_container<UnorderedMap>("unordered_map", [](auto &c, uint64_t n) { unordered_map_churn(c, n); }, nops);
+    return 0;
+}
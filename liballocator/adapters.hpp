@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+#include "allocator.hpp"
+
+// Standard library adapters (header only)
+// MemoryResource<Heap> is a std::pmr::memory_resource over one Allocator<...> heap, for the
+// std::pmr containers; StlAllocator<T, Heap> is a typed allocator for the plain ones. Both hand
+// the size and alignment of a deallocation on to the heap, so blocks it placed at their
+// alignment anyway are freed with alloc_free_sized() (buddy blocks without reading the header)
+// and only over-aligned requests take the alloc_memalign()/alloc_free() path. Neither owns the
+// heap, it has to outlive every container using it.
+
+namespace liballocator {
+
+template <class Heap>
+class MemoryResource : public std::pmr::memory_resource {
+public:
+    explicit MemoryResource(Heap &heap) noexcept : heap_(&heap) {}
+
+    Heap &heap() const noexcept { return *heap_; }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void *p = heap_->allocate(bytes ? bytes : alignment, alignment);   // 0 bytes still gets a block
+        if (!p) throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override {
+        heap_->deallocate(p, bytes ? bytes : alignment, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        auto *o = dynamic_cast<const MemoryResource *>(&other);
+        return o && o->heap_ == heap_;
+    } // one can free what the other allocated
+
+    Heap *heap_;
+};
+
+template <class T, class Heap>
+class StlAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;   // containers move their nodes, not copy them
+    using propagate_on_container_swap = std::true_type;
+
+    explicit StlAllocator(Heap &heap) noexcept : heap_(&heap) {}
+
+    template <class U>
+    StlAllocator(const StlAllocator<U, Heap> &other) noexcept : heap_(&other.heap()) {}
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) throw std::bad_array_new_length();
+        void *p = heap_->allocate(bytes(n), alignof(T));
+        if (!p) throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept { heap_->deallocate(p, bytes(n), alignof(T)); }
+
+    Heap &heap() const noexcept { return *heap_; }
+
+    template <class U>
+    bool operator==(const StlAllocator<U, Heap> &other) const noexcept { return heap_ == &other.heap(); }
+
+    template <class U>
+    bool operator!=(const StlAllocator<U, Heap> &other) const noexcept { return heap_ != &other.heap(); }
+
+private:
+    static constexpr std::size_t bytes(std::size_t n) { return (n ? n : 1) * sizeof(T); }
+
+    Heap *heap_;
+};
+
+} // namespace liballocator
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#include "api.h"
+
+// Compile time configured C++ front end (header only)
+// Allocator<MinChunk, HeaderSize, ObjsPerSlab, Type, SizeClassSteps, Flags> owns one heap whose
+// configuration is fixed by the template arguments, so what the C path derives from the runtime
+// config on every call is a constant here: the buddy order of a request is one clz, slab sizes
+// are rounded through a constexpr copy of the size class table, and the cache each class maps
+// to is resolved once per heap and kept, so a request goes straight to alloc_malloc_class().
+// Branches of the modes the instance is not in are compiled out. For the same sequence of calls
+// it hands out the same blocks as alloc_malloc() on a heap with the same config. deallocate()
+// with the size hands it to alloc_free_sized(); the aligned overloads send the requests the heap
+// does not place at their alignment anyway to alloc_memalign() and back through alloc_free().
+
+namespace liballocator {
+
+namespace detail {
+
+// mirrors SIZE_CLASS_* in my_memory.h and size_classes_init() in my_memory.c
+constexpr std::size_t kQuantum = 8;
+constexpr std::size_t kClassLimit = 64 * 1024;
+constexpr std::size_t kSmallMax = 4096;
+constexpr int kMaxClasses = 256;
+constexpr int kMaxSteps = 16;
+constexpr std::size_t kExactMemo = 1024;       // exact size mode keeps classes of objects up to this size
+
+constexpr std::size_t next_pow2(std::size_t n) {
+    return n <= 1 ? 1 : std::size_t(1) << (64 - __builtin_clzll((unsigned long long)(n - 1)));
+}
+
+constexpr int log2_of(std::size_t n) {
+    return 63 - __builtin_clzll((unsigned long long)n);
+}
+
+constexpr std::size_t lowest_bit(std::size_t n) {
+    return n & (~n + 1);
+}
+
+template <int Steps>
+struct size_class_table {
+    std::array<std::size_t, kMaxClasses> sizes{};
+    std::array<std::uint16_t, kSmallMax / kQuantum + 1> small{};   // class index per quantum
+    int count = 0;
+
+    constexpr size_class_table() {
+        constexpr int steps = Steps > kMaxSteps ? kMaxSteps : Steps;
+        if (steps <= 0) return;                    // exact sizes, no table
+        std::size_t sz = kQuantum;
+        std::size_t linear_end = kQuantum * (std::size_t)steps;
+        while (sz <= kClassLimit && count < kMaxClasses) {
+            sizes[count++] = sz;
+            if (sz < linear_end) sz += kQuantum;
+            else sz += (next_pow2(sz + 1) / 2 / (std::size_t)steps + kQuantum - 1) & ~(kQuantum - 1);
+        }
+        int c = 0;
+        for (std::size_t i = 0; i <= kSmallMax / kQuantum; ++i) {
+            while (c < count - 1 && sizes[c] < i * kQuantum) c++;
+            small[i] = (std::uint16_t)c;
+        }
+    }
+
+    constexpr int index_of(std::size_t type_bytes) const {
+        if (type_bytes > sizes[count - 1]) return -1;                    // rounded without the table in the C path
+        if (type_bytes <= kSmallMax) return small[(type_bytes + kQuantum - 1) / kQuantum];
+        int lo = 0, hi = count - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (sizes[mid] < type_bytes) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    } // first class that holds an object of type_bytes, -1 above the last one
+};
+
+} // namespace detail
+
+template <std::size_t MinChunk, std::size_t HeaderSize, int ObjsPerSlab,
+          malloc_type Type = MALLOC_BUDDY, int SizeClassSteps = 0, unsigned Flags = 0>
+class Allocator {
+    static_assert(MinChunk > 0 && (MinChunk & (MinChunk - 1)) == 0, "MinChunk must be a power of two");
+    static_assert(ObjsPerSlab > 0 || Type == MALLOC_BUDDY, "slab heaps need objects per slab");
+    static_assert(SizeClassSteps >= 0, "SizeClassSteps is 0 (exact sizes) or classes per power of two");
+
+public:
+    static constexpr std::size_t header_size = (Flags & MALLOC_F_NO_HEADER) ? 0 : HeaderSize;
+    static constexpr bool by_class = !(Flags & (MALLOC_F_THREADSAFE | MALLOC_F_GROW));   // alloc_size_class() works
+    static constexpr int min_shift = detail::log2_of(MinChunk);
+
+    Allocator(void *memory, std::size_t memory_size) : Allocator(arena(memory, memory_size)) {}
+
+    // the template arguments win over the fields they cover, the rest (purging, slab_keep_empty,
+    // slab_max_size, ...) comes from config
+    explicit Allocator(alloc_config_t config) {
+        config.type = Type;
+        config.header_size = HeaderSize;
+        config.min_mem_chunk_size = MinChunk;
+        config.n_objs_per_slab = ObjsPerSlab;
+        config.size_class_steps = SizeClassSteps;
+        config.flags = Flags;
+        heap_ = alloc_create(&config);
+        if (!heap_) throw std::bad_alloc();
+        memory_size_ = config.memory_size;
+        std::size_t blocks = memory_size_ / MinChunk;       // same max order as buddy_init()
+        while (((std::size_t)2 << max_order_) <= blocks && max_order_ + 1 < 32) max_order_++;
+        if constexpr (Type == MALLOC_HYBRID) {
+            malloc_stats_t st;
+            alloc_stats(heap_, &st);
+            slab_max_size_ = st.slab_max_size;
+        }
+        std::size_t base = (Flags & MALLOC_F_GROW) ? 4096 : detail::lowest_bit((std::size_t)config.start_of_memory);
+        natural_align_ = natural_align(base ? base : 4096);
+        forget_classes();
+    }
+
+    Allocator(const Allocator &) = delete;
+    Allocator &operator=(const Allocator &) = delete;
+
+    ~Allocator() { alloc_destroy(heap_); }
+
+    static constexpr int buddy_order(std::size_t size) {
+        std::size_t need = size + header_size;
+        if (need == 0) return 0;
+        return 64 - __builtin_clzll((unsigned long long)((need - 1) | (MinChunk - 1))) - min_shift;
+    } // block order of a request, what request_order() computes from the runtime config
+
+    void *allocate(std::size_t size) noexcept {
+        if constexpr (!by_class) {
+            return alloc_malloc(heap_, size);
+        } else if constexpr (Type == MALLOC_BUDDY) {
+            if (size == 0 || size > memory_size_ || buddy_order(size) > max_order_)
+                return alloc_malloc(heap_, size);              // failures are counted there
+            return alloc_malloc_class(heap_, buddy_order(size), size);
+        } else {
+            int cls = slab_class(size);
+            return cls >= 0 ? alloc_malloc_class(heap_, cls, size) : alloc_malloc(heap_, size);
+        }
+    }
+
+    void *allocate(std::size_t size, std::size_t alignment) noexcept {
+        if (placed_aligned(size, alignment)) return allocate(size);
+        return alloc_memalign(heap_, alignment, size);
+    } // alignment is a power of two
+
+    void deallocate(void *ptr) noexcept { alloc_free(heap_, ptr); }
+
+    void deallocate(void *ptr, std::size_t size) noexcept { alloc_free_sized(heap_, ptr, size); }
+
+    void deallocate(void *ptr, std::size_t size, std::size_t alignment) noexcept {
+        if (placed_aligned(size, alignment)) alloc_free_sized(heap_, ptr, size);
+        else alloc_free(heap_, ptr);
+    } // the size and alignment it was allocated with
+
+    void reset() noexcept {
+        alloc_reset(heap_);
+        forget_classes();                              // the caches are made again
+    }
+
+    allocator_t *heap() const noexcept { return heap_; }
+
+private:
+    static constexpr int kUnresolved = -2;
+
+    static alloc_config_t arena(void *memory, std::size_t memory_size) noexcept {
+        alloc_config_t config = {};
+        config.start_of_memory = memory;
+        config.memory_size = memory_size;
+        return config;
+    }
+
+    static constexpr detail::size_class_table<SizeClassSteps> table_{};
+
+    static constexpr std::size_t natural_align(std::size_t base) {
+        // biggest alignment allocate() keeps for every size that is a multiple of it. Buddy user
+        // pointers are base + k * block + header; packed slab objects base + slab + 2 * header
+        // + idx * object size, the object size being the request plus header or its class; the
+        // aligned slab layout starts every slab on a line with a stride of at least 16. Never
+        // more than malloc promises, so sampled objects moved up by the profiler keep it too.
+        std::size_t header = header_size ? detail::lowest_bit(header_size) : MinChunk;
+        std::size_t buddy = std::min({base, MinChunk, header});
+        std::size_t slab = std::min({base, MinChunk, header, SizeClassSteps > 0 ? detail::kQuantum : MinChunk});
+        if (Flags & MALLOC_F_SLAB_ALIGN) slab = 16;
+        std::size_t align = Type == MALLOC_BUDDY ? buddy : Type == MALLOC_SLAB ? slab : std::min(buddy, slab);
+        return std::min(align, alignof(std::max_align_t));
+    }
+
+    bool placed_aligned(std::size_t size, std::size_t alignment) const noexcept {
+        return alignment <= natural_align_ && (size & (alignment - 1)) == 0;
+    }
+    static constexpr std::size_t kMemo = SizeClassSteps > 0 ? detail::kMaxClasses : detail::kExactMemo + 1;
+
+    int slab_class(std::size_t size) noexcept {
+        // memo slot of the rounded object size, every size of a slot rounds to the same cache
+        if (size == 0 || size > memory_size_) return -1;
+        if constexpr (Type == MALLOC_HYBRID) {
+            if (size > slab_max_size_) return -1;      // buddy side
+        }
+        std::size_t type_bytes = size + header_size;
+        int slot;
+        if constexpr (SizeClassSteps > 0) slot = table_.index_of(type_bytes);
+        else slot = type_bytes <= detail::kExactMemo ? (int)type_bytes : -1;
+        if (slot < 0) return alloc_size_class(heap_, size);
+        int cls = classes_[slot];
+        if (cls == kUnresolved) cls = classes_[slot] = alloc_size_class(heap_, size);
+        return cls;
+    }
+
+    void forget_classes() noexcept {
+        for (int &c : classes_) c = kUnresolved;
+    }
+
+    allocator_t *heap_ = nullptr;
+    std::size_t memory_size_ = 0;
+    int max_order_ = 0;
+    std::size_t slab_max_size_ = 0;
+    std::size_t natural_align_ = 1;
+    std::array<int, kMemo> classes_{};
+};
+
+} // namespace liballocator
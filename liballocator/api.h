@@ -1,15 +1,179 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Allocation type
 enum malloc_type {
     MALLOC_BUDDY = 0, // Buddy allocator
     MALLOC_SLAB = 1,  // Slab allocator
+    MALLOC_HYBRID = 2, // Slab for small requests, buddy for the rest
+};
+
+// Optional behaviour, OR'd together and passed to my_setup_ex()
+enum malloc_flags {
+    MALLOC_F_THREADSAFE = 1 << 0, // lock the heap and keep per-thread magazines of freed objects
+    MALLOC_F_NO_HEADER = 1 << 1,  // no per-object header, metadata is looked up from the address
+    MALLOC_F_ZEROED = 1 << 2,     // start_of_memory is zero filled, lets calloc skip clearing fresh memory
+    MALLOC_F_GROW = 1 << 3,       // no start_of_memory: mmap regions on demand, memory_size is the first one
+    MALLOC_F_SLAB_ALIGN = 1 << 4, // pad slab objects to cache lines where cheap and color the slabs
+    MALLOC_F_PROFILE = 1 << 5,    // sample about one malloc per sample_interval bytes with its call stack
 };
 
 // APIs
-void my_setup(enum malloc_type type, int memory_size, void *start_of_memory,
-              int header_size, int min_mem_chunk_size, int n_objs_per_slab);
+// memory_size does not have to be a power of two: the region is covered with the largest
+// aligned power of two blocks that fit, only a tail smaller than min_mem_chunk_size is unused
+void my_setup(enum malloc_type type, size_t memory_size, void *start_of_memory,
+              size_t header_size, size_t min_mem_chunk_size, int n_objs_per_slab);
+void my_setup_ex(enum malloc_type type, size_t memory_size, void *start_of_memory,
+                 size_t header_size, size_t min_mem_chunk_size, int n_objs_per_slab, unsigned flags);
 void my_cleanup();
 
-void *my_malloc(int size);
+void *my_malloc(size_t size);
 void my_free(void *ptr);
+void *my_realloc(void *ptr, size_t size); // grows/shrinks buddy blocks in place when it can
+void *my_calloc(size_t n, size_t size);
+void *my_memalign(size_t alignment, size_t size); // alignment must be a power of two
+void my_free_sized(void *ptr, size_t size); // size as passed to my_malloc(), see alloc_free_sized()
+
+// Batches: my_malloc_batch() fills out[0..n) and returns how many it got; it stops at the
+// first failure, exactly like n my_malloc() calls would. my_free_batch() skips NULLs.
+int my_malloc_batch(size_t size, int n, void **out);
+void my_free_batch(void **ptrs, int n);
+
+// Statistics
+// A snapshot of the heap, filled by my_stats()/alloc_stats(). Counters start at setup (and
+// alloc_reset()); in thread safe mode objects served from the per-thread magazines do not
+// show up in the counters, only what reached the heap does.
+#define MALLOC_STATS_ORDERS 32
+#define MALLOC_STATS_CACHES 64
+
+typedef struct malloc_cache_stats {
+    size_t object_size;       // bytes per object, header included
+    int slabs;
+    int objects_used;
+    int objects_total;
+} malloc_cache_stats_t;
+
+typedef struct malloc_stats {
+    // buddy
+    int regions;                                    // 1, or the mapped regions of a MALLOC_F_GROW heap
+    size_t memory_size;
+    size_t min_chunk_size;
+    int max_order;                                  // block of order k is min_chunk_size << k
+    size_t free_blocks[MALLOC_STATS_ORDERS];        // free blocks per order
+    size_t free_bytes;
+    size_t largest_free;                            // biggest single block that can be handed out
+    uint64_t splits, merges;
+    uint64_t buddy_allocs, buddy_frees, buddy_failures;
+
+    // slab (zero in buddy mode)
+    int n_caches;                                   // caches[] holds the first MALLOC_STATS_CACHES
+    malloc_cache_stats_t caches[MALLOC_STATS_CACHES];
+    int slabs;
+    int slabs_empty;                                // kept for reuse, no object in use
+    size_t slab_max_size;                           // hybrid: biggest request served by a slab
+    size_t slab_bytes;                              // buddy memory held by slabs
+    size_t slab_slack;                              // part of it no object can use (slab tails)
+    size_t slab_idle;                               // free object room inside live slabs
+    uint64_t slab_allocs, slab_frees, slab_failures;
+    uint64_t slab_meta_failures;                    // no cache or slab id left (MAX_CACHES/MAX_SLABS), not memory
+    uint64_t slabs_created, slabs_destroyed;
+
+    // overhead of the user requests
+    uint64_t requested_bytes;
+    uint64_t granted_bytes;                         // block or object bytes spent on them
+    uint64_t header_bytes;                          // part of granted_bytes used by headers
+
+    // purging
+    size_t clean_bytes;                             // free bytes known to read as zero (never used or purged)
+    uint64_t purges, purged_bytes;
+} malloc_stats_t;
+
+void my_stats(malloc_stats_t *out);
+
+// Give the pages of every free block of at least a page back to the OS (MADV_DONTNEED) and
+// return how many bytes that was. The memory must be private anonymous (malloc, mmap), so
+// dropped pages come back zero filled; calloc then skips clearing them.
+size_t my_trim(void);
+
+// Release the empty slabs the caches keep for reuse (see slab_keep_empty) back to buddy and
+// return how many bytes that was. Slab mode only, my_trim() does this first anyway.
+size_t my_shrink(void);
+
+// Sampling heap profiler (MALLOC_F_PROFILE)
+// Writes the sampled call stacks with their live and cumulative bytes to fd: plain text with
+// estimated (unsampled) numbers and symbolized stacks, or the legacy heap profile format pprof
+// reads. Returns -1 when the heap does not sample. Needs per-object headers (not with
+// MALLOC_F_NO_HEADER); memalign and batch allocations are never sampled.
+enum malloc_profile_format {
+    MALLOC_PROFILE_TEXT = 0,
+    MALLOC_PROFILE_PPROF = 1,
+};
+
+int my_profile_dump(int fd, enum malloc_profile_format format);
+
+// Instance APIs
+// Every allocator_t is an independent heap over its own memory. The my_* functions
+// above work on a default instance that my_setup() creates and my_cleanup() destroys.
+typedef struct allocator allocator_t;
+
+typedef struct alloc_config {
+    enum malloc_type type;
+    size_t memory_size;
+    void *start_of_memory;
+    size_t header_size;
+    size_t min_mem_chunk_size;
+    int n_objs_per_slab;
+    unsigned flags;           // MALLOC_F_*
+    int size_class_steps;     // slab: round sizes to classes, this many per power of two (0 = exact sizes)
+    size_t max_memory_size;   // MALLOC_F_GROW: never map more than this in total (0 = no limit)
+    size_t purge_size;        // free blocks this big and up are purged automatically (0 = only on trim)
+    size_t purge_dirty_max;   // dirty bytes in such blocks left alone before a purge pass
+    int slab_keep_empty;      // slab: empty slabs each cache keeps for reuse (0 = release at once)
+    size_t slab_max_size;     // hybrid: biggest request served by a slab (0 = sized from the arena)
+    size_t sample_interval;   // MALLOC_F_PROFILE: mean bytes between samples (0 = PROFILE_INTERVAL, 512KB)
+} alloc_config_t;
+
+allocator_t *alloc_create(const alloc_config_t *config); // NULL if out of host memory
+void alloc_destroy(allocator_t *a);
+void alloc_reset(allocator_t *a); // drop every allocation of this heap at once
+
+void *alloc_malloc(allocator_t *a, size_t size);
+void alloc_free(allocator_t *a, void *ptr);
+void *alloc_realloc(allocator_t *a, void *ptr, size_t size);
+void *alloc_calloc(allocator_t *a, size_t n, size_t size);
+void *alloc_memalign(allocator_t *a, size_t alignment, size_t size);
+int alloc_malloc_batch(allocator_t *a, size_t size, int n, void **out);
+void alloc_free_batch(allocator_t *a, void **ptrs, int n);
+void alloc_stats(allocator_t *a, malloc_stats_t *out);
+size_t alloc_footprint(allocator_t *a); // memory_size - free_bytes of alloc_stats(), without walking the heap
+size_t alloc_trim(allocator_t *a);
+size_t alloc_shrink(allocator_t *a);
+int alloc_profile_dump(allocator_t *a, int fd, enum malloc_profile_format format);
+
+// Sized free
+// size is what the block was asked for with alloc_malloc(), alloc_calloc() (n * size),
+// alloc_malloc_batch() or alloc_malloc_class(). Buddy blocks take their order from it instead
+// of reading the header or the order map, and the thread cache its class; slab objects still
+// find their slab through the header. Not for memalign or realloc'd blocks. Heaps with
+// MALLOC_F_PROFILE need the header anyway and free as alloc_free() does.
+void alloc_free_sized(allocator_t *a, void *ptr, size_t size);
+
+// Size classes
+// Every request is served from a class: a buddy block order, or in slab mode the cache of its
+// (rounded) object size. alloc_size_class() resolves the class of a size once, and
+// alloc_malloc_class() then allocates from it without looking the size up again; the block is
+// the one alloc_malloc(size) would have returned. Front ends that know their sizes up front
+// (allocator.hpp) keep the classes they resolved. Thread safe and growable heaps, and the buddy
+// side of a hybrid heap, have no classes here (-1); alloc_malloc() serves those.
+int alloc_size_class(allocator_t *a, size_t size);
+void *alloc_malloc_class(allocator_t *a, int cls, size_t size); // size only feeds stats and the profiler
+
+#ifdef __cplusplus
+}
+#endif
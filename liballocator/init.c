@@ -1,25 +1,109 @@
 #include "api.h"
 #include "my_memory.h"
 
-void my_setup(enum malloc_type type, int memory_size, void *start_of_memory,
-              int header_size, int min_mem_chunk_size, int n_objs_per_slab) {
-    //save the arguments to global
-    global_mode_type = type;
-    global_base = start_of_memory;
-    global_memory_size = (size_t)memory_size;
-    global_header_size = (size_t)header_size;
-    global_min_chunk_size = (size_t)min_mem_chunk_size;
-    global_object_per_slab = n_objs_per_slab;
-
-    buddy_init();
-    if (global_mode_type == MALLOC_SLAB) slab_init();  //buddy helps in slab
+allocator_t* default_allocator = NULL;
 
+static void alloc_init(allocator_t* a) {
+    memset(&a->stats, 0, sizeof(a->stats));
+    buddy_init(a);
+    if (a->mode_type != MALLOC_BUDDY) slab_init(a);  //buddy helps in slab
+    if (a->thread_safe) tcache_init(a);
+}
+
+static void alloc_fini(allocator_t* a) {
+    // free nodes in free_list
+    if (a->growable) {
+        region_cleanup(a);
+        return;
+    }
+    if (a->thread_safe) tcache_cleanup(a);
+    if (a->mode_type != MALLOC_BUDDY) slab_cleanup(a);
+    buddy_cleanup(a);
+}
+
+allocator_t* alloc_create(const alloc_config_t* config) {
+    // the instance is big (slab tables), calloc gives it its own pages
+    allocator_t* a = (allocator_t*)calloc(1, sizeof(allocator_t));
+    if (!a) return NULL;
+
+    //save the arguments to the instance
+    a->mode_type = config->type;
+    a->base = config->start_of_memory;
+    a->memory_size = config->memory_size;
+    a->header_size = config->header_size;
+    a->min_chunk_size = config->min_mem_chunk_size;
+    a->object_per_slab = config->n_objs_per_slab;
+    a->thread_safe = (config->flags & MALLOC_F_THREADSAFE) != 0;
+    a->size_class_steps = config->size_class_steps;
+    a->slab_keep_empty = config->slab_keep_empty > 0 ? config->slab_keep_empty : 0;
+    a->slab_max_size = config->slab_max_size;
+    a->zeroed = (config->flags & MALLOC_F_ZEROED) != 0;
+    a->slab_align = (config->flags & MALLOC_F_SLAB_ALIGN) != 0;
+    a->purge_size = config->purge_size;
+    a->purge_dirty_max = config->purge_dirty_max;
+    a->headerless = (config->flags & MALLOC_F_NO_HEADER) != 0;
+    if (a->headerless) a->header_size = 0;     // objects and blocks start right at their address
+
+    if (config->flags & MALLOC_F_GROW) {       // the regions do the work, each one is an instance
+        a->growable = true;
+        a->thread_safe = false;
+        region_init(a, config);
+        if (!a->regions) {
+            region_cleanup(a);
+            free(a);
+            return NULL;
+        }
+        return a;
+    }
+
+    alloc_init(a);
+    profile_init(a, config);
+    a->sample_left = profile_next_gap(a);
+    return a;
+}
+
+void alloc_destroy(allocator_t* a) {
+    if (!a) return;
+    alloc_fini(a);
+    profile_cleanup(a);
+    free(a);
+}
+
+void alloc_reset(allocator_t* a) {
+    // no allocation survives, so simply build the heap again over the same memory
+    if (a->growable) {
+        region_reset(a);
+        return;
+    }
+    alloc_fini(a);
+    a->zeroed = false;                         // the dropped allocations left their data behind
+    alloc_init(a);
+    profile_reset(a);
+}
+
+void my_setup(enum malloc_type type, size_t memory_size, void *start_of_memory,
+              size_t header_size, size_t min_mem_chunk_size, int n_objs_per_slab) {
+    my_setup_ex(type, memory_size, start_of_memory, header_size, min_mem_chunk_size, n_objs_per_slab, 0);
+}
+
+void my_setup_ex(enum malloc_type type, size_t memory_size, void *start_of_memory,
+                 size_t header_size, size_t min_mem_chunk_size, int n_objs_per_slab, unsigned flags) {
+    alloc_config_t config = {
+        .type = type,
+        .memory_size = memory_size,
+        .start_of_memory = start_of_memory,
+        .header_size = header_size,
+        .min_mem_chunk_size = min_mem_chunk_size,
+        .n_objs_per_slab = n_objs_per_slab,
+        .flags = flags,
+    };
+    if (default_allocator) alloc_destroy(default_allocator);
+    default_allocator = alloc_create(&config);
     return;
 }
 
 void my_cleanup() {
-    // free nodes in free_list
-    if (global_mode_type == MALLOC_SLAB) slab_cleanup();
-    buddy_cleanup();
+    alloc_destroy(default_allocator);
+    default_allocator = NULL;
     return;
-}
\ No newline at end of file
+}
@@ -4,24 +4,229 @@
 // Interface implementation
 // Implement APIs here...
 
-void *my_malloc(int size) {
-    if (global_mode_type == MALLOC_BUDDY) {
-        return buddy_malloc(size); }
+void *heap_malloc(allocator_t *a, size_t size) {
+    if (a->thread_safe) return tcache_malloc_unsampled(a, size);
+    if (a->mode_type == MALLOC_BUDDY) return buddy_malloc(a, size);
+    return slab_malloc(a, size);
+} // malloc without the sampling countdown
+
+void heap_free(allocator_t *a, void *ptr) {
+    if (a->thread_safe) tcache_free(a, ptr);
+    else if (a->mode_type == MALLOC_BUDDY) buddy_free(a, ptr);
+    else slab_free(a, ptr);
+}
+
+void *alloc_malloc(allocator_t *a, size_t size) {
+    if (a->growable) return region_malloc(a, size);
+    if (a->thread_safe) return tcache_malloc(a, size);
+    if ((a->sample_left -= (int64_t)size) < 0) return profile_malloc(a, &a->sample_left, size);
+    if (a->mode_type == MALLOC_BUDDY) {
+        return buddy_malloc(a, size); }
     else {
-        return slab_malloc(size);
+        return slab_malloc(a, size);
     }
     
     return NULL;
 }
 
-void my_free(void *ptr) {
+void alloc_free(allocator_t *a, void *ptr) {
     if (!ptr) return;
-    if (global_mode_type == MALLOC_BUDDY){
-        buddy_free(ptr);
+    if (a->growable) {
+        region_free(a, ptr);
+        return;
+    }
+    if (profile_sampled(a, ptr)) {
+        profile_free(a, ptr);
+        return;
+    }
+    if (a->thread_safe) {
+        tcache_free(a, ptr);
+        return;
+    }
+    if (a->mode_type == MALLOC_BUDDY){
+        buddy_free(a, ptr);
     }
     else {
-        return slab_free(ptr);
+        return slab_free(a, ptr);
     }
 
    
 }
+
+void alloc_free_sized(allocator_t *a, void *ptr, size_t size) {
+    if (!ptr) return;
+    if (a->growable) {
+        region_free_sized(a, ptr, size);
+        return;
+    }
+    if (a->profile) {                      // only the header tells a sampled object apart
+        alloc_free(a, ptr);
+        return;
+    }
+    if (a->thread_safe) tcache_free_sized(a, ptr, size);
+    else if (a->mode_type == MALLOC_BUDDY) buddy_free_sized(a, ptr, size);
+    else slab_free_sized(a, ptr, size);
+}
+
+void *alloc_realloc(allocator_t *a, void *ptr, size_t size) {
+    // same contract as realloc(): NULL ptr mallocs, size 0 frees, on failure the old block stays
+    if (!ptr) return alloc_malloc(a, size);
+    if (size == 0) {
+        alloc_free(a, ptr);
+        return NULL;
+    }
+    if (a->growable) return region_realloc(a, ptr, size);
+    if (profile_sampled(a, ptr)) return profile_realloc(a, ptr, size);
+
+    if (a->thread_safe) pthread_mutex_lock(&a->heap_lock);
+    size_t old_size;
+    bool in_place;
+    if (a->mode_type == MALLOC_BUDDY || (a->mode_type == MALLOC_HYBRID && slab_class_of_ptr(a, ptr) < 0)) {
+        old_size = buddy_usable_size(a, ptr);
+        in_place = buddy_resize_in_place(a, ptr, size);
+    } else {
+        old_size = slab_usable_size(a, ptr);
+        in_place = size <= old_size;                // still fits the object it has
+    }
+    if (a->thread_safe) pthread_mutex_unlock(&a->heap_lock);
+    if (in_place) return ptr;
+
+    void *moved = alloc_malloc(a, size);          // no way around a copy
+    if (!moved) return NULL;
+    memcpy(moved, ptr, old_size < size ? old_size : size);
+    alloc_free(a, ptr);
+    return moved;
+}
+
+void *alloc_calloc(allocator_t *a, size_t n, size_t size) {
+    if (n == 0 || size == 0 || n > SIZE_MAX / size) return NULL;
+    size_t total = n * size;
+    if (a->growable) return region_calloc(a, total);
+    if (a->thread_safe) {                  // cached objects are always dirty
+        void *p = alloc_malloc(a, total);
+        if (p) memset(p, 0, total);
+        return p;
+    }
+    if ((a->sample_left -= (int64_t)total) < 0) {
+        void *p = profile_malloc(a, &a->sample_left, total);
+        if (p) memset(p, 0, total);
+        return p;
+    }
+    if (a->mode_type == MALLOC_BUDDY) return buddy_calloc(a, total);
+    return slab_calloc(a, total);
+}
+
+void *alloc_memalign(allocator_t *a, size_t alignment, size_t size) {
+    if (a->growable) return region_memalign(a, alignment, size);
+    if (a->thread_safe) pthread_mutex_lock(&a->heap_lock);
+    void *p = a->mode_type == MALLOC_BUDDY ? buddy_memalign(a, alignment, size) : slab_memalign(a, alignment, size);
+    if (a->thread_safe) pthread_mutex_unlock(&a->heap_lock);
+    if (!p && a->thread_safe) {            // cached blocks may be what it is missing
+        tcache_flush(a);
+        pthread_mutex_lock(&a->heap_lock);
+        p = a->mode_type == MALLOC_BUDDY ? buddy_memalign(a, alignment, size) : slab_memalign(a, alignment, size);
+        pthread_mutex_unlock(&a->heap_lock);
+    }
+    return p;
+}
+
+int alloc_malloc_batch(allocator_t *a, size_t size, int n, void **out) {
+    if (a->growable) return region_malloc_batch(a, size, n, out);
+    if (a->thread_safe) {                  // the thread cache is already amortised
+        int got = 0;
+        while (got < n && (out[got] = tcache_malloc(a, size)) != NULL) got++;
+        return got;
+    }
+    if (a->mode_type == MALLOC_BUDDY) return buddy_malloc_batch(a, size, n, out);
+    return slab_malloc_batch(a, size, n, out);
+}
+
+void alloc_free_batch(allocator_t *a, void **ptrs, int n) {
+    if (a->growable) {
+        for (int i = 0; i < n; i++) if (ptrs[i]) region_free(a, ptrs[i]);
+    } else if (a->profile) {                   // sampled objects may be among them
+        for (int i = 0; i < n; i++) alloc_free(a, ptrs[i]);
+    } else if (a->thread_safe) {
+        for (int i = 0; i < n; i++) if (ptrs[i]) tcache_free(a, ptrs[i]);
+    } else if (a->mode_type == MALLOC_BUDDY) {
+        for (int i = 0; i < n; i++) if (ptrs[i]) buddy_free(a, ptrs[i]);
+    } else {
+        for (int i = 0; i < n; i++) if (ptrs[i]) slab_free(a, ptrs[i]);
+    }
+}
+
+size_t alloc_trim(allocator_t *a) {
+    if (a->growable) return region_trim(a);
+    if (a->thread_safe) tcache_flush(a);   // cached blocks can merge and get purged too
+    if (a->thread_safe) pthread_mutex_lock(&a->heap_lock);
+    if (a->mode_type != MALLOC_BUDDY) slab_shrink(a);      // kept empty slabs hold pages too
+    size_t purged = buddy_purge(a, 0);
+    if (a->thread_safe) pthread_mutex_unlock(&a->heap_lock);
+    return purged;
+}
+
+size_t alloc_shrink(allocator_t *a) {
+    if (a->growable) return region_shrink(a);
+    if (a->thread_safe) tcache_flush(a);   // cached objects keep their slabs from emptying
+    if (a->mode_type == MALLOC_BUDDY) return 0;
+    if (a->thread_safe) pthread_mutex_lock(&a->heap_lock);
+    size_t released = slab_shrink(a);
+    if (a->thread_safe) pthread_mutex_unlock(&a->heap_lock);
+    return released;
+}
+
+int alloc_size_class(allocator_t *a, size_t size) {
+    if (a->growable || a->thread_safe) return -1;
+    if (a->mode_type == MALLOC_BUDDY) return buddy_size_class(a, size);
+    return slab_size_class(a, size, true);
+}
+
+void *alloc_malloc_class(allocator_t *a, int cls, size_t size) {
+    if ((a->sample_left -= (int64_t)size) < 0) return profile_malloc(a, &a->sample_left, size);
+    if (a->mode_type == MALLOC_BUDDY) {
+        if (cls < 0 || cls > a->max_order) return NULL;
+        return buddy_malloc_class(a, cls, size);
+    }
+    if (cls < 0 || cls >= a->cache_count) return NULL;
+    return slab_malloc_class(a, cls, size);
+}
+
+void *my_malloc(size_t size) {
+    return alloc_malloc(default_allocator, size);
+}
+
+void my_free(void *ptr) {
+    alloc_free(default_allocator, ptr);
+}
+
+void my_free_sized(void *ptr, size_t size) {
+    alloc_free_sized(default_allocator, ptr, size);
+}
+
+void *my_realloc(void *ptr, size_t size) {
+    return alloc_realloc(default_allocator, ptr, size);
+}
+
+void *my_calloc(size_t n, size_t size) {
+    return alloc_calloc(default_allocator, n, size);
+}
+
+void *my_memalign(size_t alignment, size_t size) {
+    return alloc_memalign(default_allocator, alignment, size);
+}
+
+int my_malloc_batch(size_t size, int n, void **out) {
+    return alloc_malloc_batch(default_allocator, size, n, out);
+}
+
+void my_free_batch(void **ptrs, int n) {
+    alloc_free_batch(default_allocator, ptrs, n);
+}
+
+size_t my_trim(void) {
+    return alloc_trim(default_allocator);
+}
+
+size_t my_shrink(void) {
+    return alloc_shrink(default_allocator);
+}
@@ -1,39 +1,23 @@
+#include <sys/mman.h>
+
 #include "my_memory.h"
 
 // Memory allocator implementation
 // Implement all other functions here...
 
-void* global_base = NULL;
-size_t global_memory_size = 0;
-size_t global_header_size = 0;
-size_t global_min_chunk_size = 0;
-int global_object_per_slab = 0;
-
-
-enum malloc_type global_mode_type = MALLOC_BUDDY;
+// Every function works on one allocator instance (see struct allocator in my_memory.h)
 
+static void size_classes_init(allocator_t* a);
+static void* slab_alloc_obj(allocator_t* a, int cache_id, bool* clean);
 
-typedef struct free_node {
-    struct free_node* next;
-    size_t offset;
-} free_node_t;
-
-#define MAX_ORDERS 32
-static free_node_t* global_free_lists[MAX_ORDERS];
-static int global_max_order;
-
-static inline size_t order_to_size(int order){
-    return (size_t)global_min_chunk_size << order;
+static inline size_t order_to_size(allocator_t* a, int order){
+    return (size_t)a->min_chunk_size << order;
 } // returns the block size from the given order number
 
-static inline int size_to_order(size_t size_rounded){
-    int order = 0;
-    size_t size = global_min_chunk_size;
-    while (size < size_rounded) {
-        size <<= 1;
-        order++;
-    }
-    return order;
+static inline int size_to_order(allocator_t* a, size_t size_rounded){
+    // size_rounded is a power of two, anything up to a min chunk is order 0
+    if (size_rounded <= a->min_chunk_size) return 0;
+    return __builtin_ctzll((unsigned long long)size_rounded) - a->min_shift;
 } // reverse process from above
 
 static inline size_t next_powerof2(size_t n){
@@ -44,122 +28,240 @@ static inline size_t next_powerof2(size_t n){
     n |= n >> 4;
     n |= n >> 8;
     n |= n >> 16;
-    #if UINPTR_MAX > 0xFFFFFFFFu
+    #if SIZE_MAX > 0xFFFFFFFFu
         n |= n >> 32;
     #endif
     n++;
     return n;
 } // function for rounding up the power 2
 
-static inline size_t pointer_to_offset(void* p){
-    return (size_t)((char*)p - (char*)global_base);
+static inline size_t pointer_to_offset(allocator_t* a, void* p){
+    return (size_t)((char*)p - (char*)a->base);
 } // convert the pointer to byte offset so we know which byte block starts
 
-static inline void* offset_to_pointer(size_t off){
-    return (void*)((char*)global_base + off);
+static inline void* offset_to_pointer(allocator_t* a, size_t off){
+    return (void*)((char*)a->base + off);
 } // convert back to pointer from give byte offset
 
 static inline size_t buddy_of(size_t off, size_t block_size){
     return (off ^ block_size);
 } //finds the offset of the block pair after splitting them to power of 2
 
-// this for free list operation
-static void freelist_insert_sort(int order, size_t block_off){
-    free_node_t* node = (free_node_t*)malloc(sizeof(free_node_t));
-    node -> offset = block_off;
-    free_node_t** head = &global_free_lists[order];
-    if (*head == NULL || (*head)->offset > block_off){
-        node->next = *head;
-        *head = node;
-        return;
-    }
-    free_node_t* current = *head;
-    while (current->next && current->next->offset < block_off) current = current->next;
-    node->next = current->next;
-    current->next = node;
-} // create node and insert into the free list and sort them
-
-static bool freelist_remove(int order, size_t block_off){
-    free_node_t** head  = &global_free_lists[order];
-    free_node_t* current = *head;
-    free_node_t* prev = NULL;
-    while (current){
-        if (current->offset == block_off){
-            if (prev) prev->next = current->next;
-            else *head = current->next;
-            free(current);
-            return true;
-        }
-        prev = current;
-        current = current->next;
+static inline size_t block_index(allocator_t* a, size_t off, int order){
+    return off >> (a->min_shift + order);
+} // index of the block inside the bitmap of its order
+
+static inline bool block_fits(allocator_t* a, size_t off, int order){
+    return (off >> a->min_shift) + ((size_t)1 << order) <= a->nchunks;
+} // false for the buddies a region that is not a power of two never had
+
+// this for the per order bitmap
+static inline bool bitmap_test(allocator_t* a, int order, size_t idx){
+    return (a->free_bits[order][idx >> 6] >> (idx & 63)) & 1u;
+}
+
+static inline void bitmap_set(allocator_t* a, int order, size_t idx){
+    a->free_bits[order][idx >> 6] |= (uint64_t)1 << (idx & 63);
+    a->free_summary[order][idx >> 12] |= (uint64_t)1 << ((idx >> 6) & 63);
+}
+
+static inline void bitmap_clear(allocator_t* a, int order, size_t idx){
+    uint64_t* word = &a->free_bits[order][idx >> 6];
+    *word &= ~((uint64_t)1 << (idx & 63));
+    if (*word == 0) a->free_summary[order][idx >> 12] &= ~((uint64_t)1 << ((idx >> 6) & 63));
+}
+
+// clean bits ride along with the free bits: set -> this free block reads as zero except
+// for its free list node, because it was never written or because it was purged
+static inline bool clean_test(allocator_t* a, int order, size_t idx){
+    return (a->clean_bits[order][idx >> 6] >> (idx & 63)) & 1u;
+}
+
+static inline void clean_mark(allocator_t* a, int order, size_t idx, bool clean){
+    uint64_t bit = (uint64_t)1 << (idx & 63);
+    if (clean) a->clean_bits[order][idx >> 6] |= bit;
+    else a->clean_bits[order][idx >> 6] &= ~bit;
+}
+
+static bool bitmap_find_first(allocator_t* a, int order, size_t* out_idx){
+    // scan the summary for the first non zero bitmap word, then ctz inside that word
+    for (size_t s = 0; s < a->summary_words[order]; ++s) {
+        uint64_t sw = a->free_summary[order][s];
+        if (!sw) continue;
+        size_t w = (s << 6) + (size_t)__builtin_ctzll(sw);
+        *out_idx = (w << 6) + (size_t)__builtin_ctzll(a->free_bits[order][w]);
+        return true;
     }
     return false;
-} // find node with given offset and remove
-
-static bool freelist_pop_lowest(int order, size_t* out_off){
-    free_node_t** head = &global_free_lists[order];
-    if (*head == NULL) return false;
-    free_node_t* n = *head;
-    *out_off = n->offset;
-    *head = n->next;
-    free(n);
+} // lowest free block index of this order
+
+// this for free list operation
+static void freelist_push(allocator_t* a, int order, size_t block_off, bool clean){
+    free_node_t* node = (free_node_t*)offset_to_pointer(a, block_off);
+    free_node_t** head = &a->free_lists[order];
+    node->prev = NULL;
+    node->next = *head;
+    if (*head) (*head)->prev = node;
+    *head = node;
+    a->free_counts[order]++;
+    size_t idx = block_index(a, block_off, order);
+    bitmap_set(a, order, idx);
+    clean_mark(a, order, idx, clean);
+    if (!clean && order >= a->purge_order) a->dirty_bytes += order_to_size(a, order);
+} // write the node inside the free block and mark it free in the bitmap
+
+static bool freelist_unlink(allocator_t* a, int order, size_t block_off){
+    free_node_t* node = (free_node_t*)offset_to_pointer(a, block_off);
+    if (node->prev) node->prev->next = node->next;
+    else a->free_lists[order] = node->next;
+    if (node->next) node->next->prev = node->prev;
+    a->free_counts[order]--;
+    size_t idx = block_index(a, block_off, order);
+    bitmap_clear(a, order, idx);
+    bool clean = clean_test(a, order, idx);
+    if (!clean && order >= a->purge_order) a->dirty_bytes -= order_to_size(a, order);
+    return clean;
+} // take a block known to be free out of its list, true if it was clean
+
+static bool freelist_remove(allocator_t* a, int order, size_t block_off){
+    if (!bitmap_test(a, order, block_index(a, block_off, order))) return false;
+    freelist_unlink(a, order, block_off);
     return true;
-} // pop the head, removes the lowest address of free block
+} // remove the block with given offset if it is free, O(1)
+
+static bool freelist_pop_lowest(allocator_t* a, int order, size_t* out_off, bool* clean){
+    size_t idx;
+    if (!bitmap_find_first(a, order, &idx)) return false;
+    *out_off = idx << (a->min_shift + order);
+    *clean = freelist_unlink(a, order, *out_off);
+    return true;
+} // removes the lowest address of free block
 
 // this for split and merging
-static bool split(int want_order, int* from_order, size_t* out_off){
+static bool split(allocator_t* a, int want_order, int* from_order, size_t* out_off, bool* clean){
     // find the lowest order that has free block that is greater than the order that we want
     // split them, now one parent has two child, then we insert both to the lower order
     // we pop the buddy of the lowest address until we reach the order that we want
     int order;
     size_t off;
-    for (order = want_order; order <= global_max_order; ++order) {
-        if (freelist_pop_lowest(order, &off)) {
+    for (order = want_order; order <= a->max_order; ++order) {
+        if (freelist_pop_lowest(a, order, &off, clean)) {
             break;
         }
     }
-    if (order > global_max_order) return false;
+    if (order > a->max_order) return false;
     while (order > want_order) {
-        size_t size = order_to_size(order);
+        size_t size = order_to_size(a, order);
         size_t half = size >> 1;
         size_t right_off = off + half;
-        freelist_insert_sort(order - 1, right_off);
+        freelist_push(a, order - 1, right_off, *clean);      // halves of a clean block are clean
         order -= 1;
+        a->stats.splits++;
     }
     *from_order = order;
     *out_off = off;
     return true;    
 }
 
-static size_t merge(size_t off, int* io_order){
+static size_t merge(allocator_t* a, size_t off, int* io_order){
     // while buddy exist, remove the buddy node, take the min of offset and buddy offset, then +1 order
     int order = *io_order;
-    while (1) {
-        size_t size = order_to_size(order);
+    while (order < a->max_order) {
+        size_t size = order_to_size(a, order);
         size_t b_off = buddy_of(off, size);
-        if (!freelist_remove(order, b_off)) break;
+        if (!block_fits(a, b_off, order) || !freelist_remove(a, order, b_off)) break;
         off = (b_off < off) ? b_off : off;
         order += 1;
-        if (order > global_max_order) break;
+        a->stats.merges++;
     }
     *io_order = order;
     return off;    
 }
     
-static inline header_t* header_from_user_ptr(void* user_ptr){
-    return (header_t*)((char*)user_ptr - global_header_size);
+// internal tag
+#define TAG_BUDY 0x42554459u
+#define TAG_ALGN 0x414C474Eu     // marker header in front of a memalign pointer
+#define TAG_SLAB 0x534C4142u
+
+static inline void note_request(allocator_t* a, int n, size_t user_size, size_t granted){
+    a->stats.requested_bytes += (uint64_t)n * user_size;
+    a->stats.granted_bytes += (uint64_t)n * granted;
+    a->stats.header_bytes += (uint64_t)n * a->header_size;
+} // overhead counters: what the user asked for against what it cost
+
+static inline size_t zero_prefix(size_t user_size){
+    return user_size < sizeof(free_node_t) ? user_size : sizeof(free_node_t);
+} // bytes a calloc still clears in never touched memory (free list node / slab link)
+
+static inline header_t* header_from_user_ptr(allocator_t* a, void* user_ptr){
+    return (header_t*)((char*)user_ptr - a->header_size);
 } // find the header from the pointer of the block when doing free
 
 static inline header_t* header_block(void* block_start){
     return (header_t*)block_start;
 } // give the header location at the start of the block when doing malloc
 
+static inline size_t chunk_index(allocator_t* a, void* p){
+    return pointer_to_offset(a, p) >> a->min_shift;
+} // which min chunk the address falls into, used by the header-less maps
+
+static inline uint32_t block_pad(allocator_t* a, void* user_ptr){
+    if (a->headerless) return 0;
+    header_t* h = header_from_user_ptr(a, user_ptr);
+    return h->tag == TAG_ALGN ? h->order : 0;
+} // how far a memalign pointer was moved up from the normal user pointer
+
+static inline void* buddy_canonical(allocator_t* a, void* user_ptr){
+    return (char*)user_ptr - block_pad(a, user_ptr);
+} // the user pointer buddy_malloc would have returned for this block
+
+static inline int block_order_of(allocator_t* a, void* user_ptr){
+    if (a->headerless) return a->chunk_order[chunk_index(a, user_ptr)];
+    return (int)header_from_user_ptr(a, user_ptr)->order;
+} // order of an allocated block, from its header or from the chunk order map
 
 
-// internal tag
-#define TAG_BUDY 0x42554459u
 
-void *buddy_malloc(int user_size){
+
+static void* buddy_hand_out(allocator_t* a, size_t off, int order){
+    a->stats.buddy_allocs++;
+    void* block_start = offset_to_pointer(a, off);
+    if (a->headerless) {
+        a->chunk_order[off >> a->min_shift] = (uint8_t)order;   // header_size is 0 here
+    } else {
+        header_t* hdr = header_block(block_start);
+        hdr->tag = TAG_BUDY;
+        hdr->order = (uint32_t)order;
+    }
+    return (void*)((char*)block_start + a->header_size);   
+} // write the header of a block taken off the free lists and return the user pointer
+
+static inline int request_order(allocator_t* a, size_t user_size){
+    if (user_size > a->memory_size) return a->max_order + 1;      // keeps the rounding below from overflowing
+    size_t need = user_size + a->header_size;
+    if (need == 0) return 0;
+    // log2 of the next power of two; or'ing in min_chunk - 1 makes anything up to a min chunk
+    // order 0 without a branch that mispredicts on mixed sizes
+    return 64 - __builtin_clzll((unsigned long long)((need - 1) | (a->min_chunk_size - 1))) - a->min_shift;
+}
+
+static void* buddy_alloc_order(allocator_t* a, int want_order, bool* clean){
+    size_t off;
+    if (want_order > a->max_order) {              // max_order stops at MAX_ORDERS - 1 on huge arenas
+        a->stats.buddy_failures++;
+        return NULL;
+    }
+    if (!freelist_pop_lowest(a, want_order, &off, clean)) {
+        int from_order = -1;
+        if (!split(a, want_order, &from_order, &off, clean)) {
+            a->stats.buddy_failures++;
+            return NULL;
+        }
+    }
+    return buddy_hand_out(a, off, want_order);
+}
+
+static void* buddy_alloc(allocator_t* a, size_t user_size, bool* clean){
     // user size + global header 8
     // max of result and min chunk 512
     // call next power 2 to know which block size to use
@@ -168,271 +270,863 @@ void *buddy_malloc(int user_size){
     // find the start block
     // write the header at the start block
     // return the pointer, which + 8
-    if (user_size <= 0) return NULL;
-    size_t need = (size_t)user_size + global_header_size;
-    if (need < global_min_chunk_size) need = global_min_chunk_size;
-    size_t blk = next_powerof2(need);
-    int want_order = size_to_order(blk);
+    if (user_size == 0) return NULL;
+    return buddy_alloc_order(a, request_order(a, user_size), clean);
+}
 
-    size_t off;
-    if (!freelist_pop_lowest(want_order, &off)) {
-        int from_order = -1;
-        if (!split(want_order, &from_order, &off)) return NULL;
+int buddy_malloc_batch(allocator_t* a, size_t user_size, int n, void** out){
+    // Same blocks, same order as n buddy_malloc calls. Splitting the lowest bigger block
+    // would hand out its pieces left to right anyway, so we carve as many pieces as we
+    // need in one go and give the tail back as the aligned blocks the splits would leave
+    if (user_size == 0 || n <= 0) return 0;
+    int want_order = request_order(a, user_size);
+    if (want_order > a->max_order) {
+        a->stats.buddy_failures++;
+        return 0;
+    }
+    size_t piece = order_to_size(a, want_order);
+    bool clean;
+    int got = 0;
+    while (got < n) {
+        size_t off;
+        if (freelist_pop_lowest(a, want_order, &off, &clean)) {
+            out[got++] = buddy_hand_out(a, off, want_order);
+            continue;
+        }
+        int order;
+        for (order = want_order + 1; order <= a->max_order; ++order) {
+            if (freelist_pop_lowest(a, order, &off, &clean)) break;
+        }
+        if (order > a->max_order) {
+            a->stats.buddy_failures++;
+            break;
+        }
+
+        size_t end = off + order_to_size(a, order);
+        size_t pieces = (size_t)1 << (order - want_order);
+        size_t take = pieces < (size_t)(n - got) ? pieces : (size_t)(n - got);
+        for (size_t i = 0; i < take; ++i) out[got++] = buddy_hand_out(a, off + i * piece, want_order);
+
+        size_t cur = off + take * piece;
+        a->stats.splits += take - 1;               // every split leaves one block more
+        while (cur < end) {                        // biggest aligned block that fits at cur
+            int o = order - 1;
+            while ((cur & (order_to_size(a, o) - 1)) || cur + order_to_size(a, o) > end) o--;
+            freelist_push(a, o, cur, clean);
+            cur += order_to_size(a, o);
+            a->stats.splits++;
+        }
+    }
+    note_request(a, got, user_size, piece);
+    return got;
+}
+
+void *buddy_malloc(allocator_t* a, size_t user_size){
+    bool clean;
+    void* p = buddy_alloc(a, user_size, &clean);
+    if (p) note_request(a, 1, user_size, order_to_size(a, block_order_of(a, p)));
+    return p;
+}
+
+void* buddy_calloc(allocator_t* a, size_t user_size){
+    bool clean;
+    void* p = buddy_alloc(a, user_size, &clean);
+    if (p) note_request(a, 1, user_size, order_to_size(a, block_order_of(a, p)));
+    if (p) memset(p, 0, clean ? zero_prefix(user_size) : user_size);
+    return p;
+}
+
+void* buddy_memalign(allocator_t* a, size_t alignment, size_t user_size){
+    // blocks are aligned to their size relative to base, so with no header a big enough
+    // block does it when base itself is aligned. With a header we over allocate, move the
+    // pointer up and put a TAG_ALGN header right before it holding the distance (pad)
+    // back to the normal user pointer, which buddy_canonical() follows on free
+    if (user_size == 0 || alignment == 0 || (alignment & (alignment - 1))) return NULL;
+    if (user_size > a->memory_size || alignment > a->memory_size) return NULL;
+    bool clean;
+    if (a->headerless) {
+        if ((uintptr_t)a->base & (alignment - 1)) return NULL;    // no room to record a pad
+        size_t need = user_size > alignment ? user_size : alignment;
+        void* p = buddy_alloc(a, need, &clean);
+        if (p) note_request(a, 1, user_size, order_to_size(a, block_order_of(a, p)));
+        return p;
     }
+    if (alignment > UINT32_MAX / 2) return NULL;                 // the pad must fit header_t.order
+    size_t need = user_size + alignment + a->header_size;
+    uint8_t* p = (uint8_t*)buddy_alloc(a, need, &clean);
+    if (!p) return NULL;
+    note_request(a, 1, user_size, order_to_size(a, block_order_of(a, p)));
+    uintptr_t aligned = ((uintptr_t)p + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (aligned != (uintptr_t)p && aligned - (uintptr_t)p < a->header_size) aligned += alignment;   // room for the marker
+    if (aligned == (uintptr_t)p) return p;
+    header_t* mark = header_from_user_ptr(a, (void*)aligned);
+    mark->tag = TAG_ALGN;
+    mark->order = (uint32_t)(aligned - (uintptr_t)p);
+    return (void*)aligned;
+}
 
-    void* block_start = offset_to_pointer(off);
-    header_t* hdr = header_block(block_start);
-    hdr->tag = TAG_BUDY;
-    hdr->order = (uint32_t)want_order;
-    return (void*)((char*)block_start + global_header_size);   
+int buddy_size_class(allocator_t* a, size_t user_size){
+    if (user_size == 0) return -1;
+    int order = request_order(a, user_size);
+    return order <= a->max_order ? order : -1;
+} // the block order a request of this size is served from
+
+size_t buddy_class_size(allocator_t* a, int order){
+    return order_to_size(a, order);
+}
+
+void* buddy_malloc_class(allocator_t* a, int order, size_t user_size){
+    bool clean;
+    void* p = buddy_alloc_order(a, order, &clean);
+    if (p) note_request(a, 1, user_size, order_to_size(a, order));
+    return p;
 }
 
-void buddy_free(void* user_ptr){
+int buddy_class_of_ptr(allocator_t* a, void* user_ptr){
+    if (block_pad(a, user_ptr)) return -1;       // memalign blocks bypass the thread cache
+    return block_order_of(a, user_ptr);
+}
+
+static void buddy_release(allocator_t* a, void* user_ptr, int order){
+    size_t off = pointer_to_offset(a, user_ptr) - a->header_size;
+    if (a->headerless) a->chunk_order[off >> a->min_shift] = CHUNK_FREE;
+    a->stats.buddy_frees++;
+    off = merge(a, off, &order);
+    freelist_push(a, order, off, false);
+    if (a->dirty_bytes > a->purge_dirty_max) buddy_purge(a, a->purge_order);
+} // give back a block of known order, merged with its free buddies
+
+void buddy_free(allocator_t* a, void* user_ptr){
     // find the header, call header from userptr
     // find the order from the header
     // find header location, call headerblock
     // insert the offset into global freelist
     // try merging, call buddy_of, if present, remove it and merge them together
-    header_t* hdr = header_from_user_ptr(user_ptr);
-    int order = (int)hdr->order;
-    size_t off = pointer_to_offset((void*)hdr);
-    off = merge(off, &order);
-    freelist_insert_sort(order, off);
+    user_ptr = buddy_canonical(a, user_ptr);
+    buddy_release(a, user_ptr, block_order_of(a, user_ptr));
 }
 
-void buddy_init(void) {
+void buddy_free_sized(allocator_t* a, void* user_ptr, size_t user_size){
+    buddy_release(a, user_ptr, request_order(a, user_size));
+} // the order follows from the request size, neither the header nor the order map is read
+
+// Purging
+// Free blocks of purge_order and up count as dirty until their pages went back to the OS
+// with MADV_DONTNEED. Once dirty_bytes passes purge_dirty_max a free purges all of them, so
+// the memory of a burst goes back in one pass instead of one madvise per free. A purged
+// block is clean: private anonymous pages read as zero after MADV_DONTNEED, so calloc
+// and new slabs skip the clearing, and splitting keeps the halves clean.
+static bool purge_block(allocator_t* a, size_t off, size_t blk){
+    // the free node stays in place, pages are dropped in between, the partial pages at
+    // both ends (only when base is not page aligned) are cleared by hand
+    uintptr_t page = a->page_size;
+    uintptr_t from = (uintptr_t)offset_to_pointer(a, off) + sizeof(free_node_t);
+    uintptr_t end = (uintptr_t)offset_to_pointer(a, off + blk);
+    uintptr_t lo = (from + page - 1) & ~(page - 1);
+    uintptr_t hi = end & ~(page - 1);
+    if (hi <= lo) {
+        memset((void*)from, 0, end - from);
+        return true;
+    }
+    if (madvise((void*)lo, hi - lo, MADV_DONTNEED) != 0) return false;
+    memset((void*)from, 0, lo - from);
+    memset((void*)hi, 0, end - hi);
+    return true;
+}
+
+size_t buddy_purge(allocator_t* a, int min_order){
+    if (min_order < a->page_order) min_order = a->page_order;     // smaller blocks share pages
+    size_t purged = 0;
+    for (int o = min_order; o <= a->max_order; ++o) {
+        size_t blk = order_to_size(a, o);
+        for (size_t s = 0; s < a->summary_words[o]; ++s) {
+            for (uint64_t sw = a->free_summary[o][s]; sw; sw &= sw - 1) {
+                size_t w = (s << 6) + (size_t)__builtin_ctzll(sw);
+                for (uint64_t dirty = a->free_bits[o][w] & ~a->clean_bits[o][w]; dirty; dirty &= dirty - 1) {
+                    size_t idx = (w << 6) + (size_t)__builtin_ctzll(dirty);
+                    if (!purge_block(a, idx << (a->min_shift + o), blk)) {
+                        a->purge_order = MAX_ORDERS;     // memory that can not be purged, stop trying
+                        a->dirty_bytes = 0;
+                        goto done;
+                    }
+                    clean_mark(a, o, idx, true);
+                    if (o >= a->purge_order) a->dirty_bytes -= blk;
+                    purged += blk;
+                }
+            }
+        }
+    }
+done:
+    if (purged) {
+        a->stats.purges++;
+        a->stats.purged_bytes += purged;
+    }
+    return purged;
+} // drop the pages of every dirty free block of min_order and up, returns the bytes purged
+
+size_t buddy_usable_size(allocator_t* a, void* user_ptr){
+    uint32_t pad = block_pad(a, user_ptr);
+    return order_to_size(a, block_order_of(a, (char*)user_ptr - pad)) - a->header_size - pad;
+}
+
+static inline void set_block_order(allocator_t* a, size_t off, int order){
+    if (a->headerless) a->chunk_order[off >> a->min_shift] = (uint8_t)order;
+    else header_block(offset_to_pointer(a, off))->order = (uint32_t)order;
+}
+
+bool buddy_resize_in_place(allocator_t* a, void* user_ptr, size_t new_size){
+    // shrink: keep the lower half, the upper halves go back to the free lists. Their buddy
+    //         is the part we keep, so they can not merge and are pushed as they are
+    // grow:   only when the block is the lower half at every order on the way up and each
+    //         upper buddy is free as a whole; check all of them before taking any
+    // the counters take it like the split/merge and the request of a malloc/free pair
+    int want = buddy_size_class(a, new_size);
+    if (want < 0 || block_pad(a, user_ptr)) return false;
+    int order = block_order_of(a, user_ptr);
+    size_t off = pointer_to_offset(a, user_ptr) - a->header_size;
+    if (want == order) return true;
+
+    if (want < order) {
+        while (order > want) {
+            order -= 1;
+            freelist_push(a, order, off + order_to_size(a, order), false);
+            a->stats.splits++;
+        }
+        set_block_order(a, off, want);
+        note_request(a, 1, new_size, order_to_size(a, want));
+        if (a->dirty_bytes > a->purge_dirty_max) buddy_purge(a, a->purge_order);    // as a free would
+        return true;
+    }
+
+    for (int o = order; o < want; ++o) {
+        size_t size = order_to_size(a, o);
+        if (off & size) return false;                                  // we are the upper half
+        if (!block_fits(a, off + size, o)) return false;
+        if (!bitmap_test(a, o, block_index(a, off + size, o))) return false;
+    }
+    for (int o = order; o < want; ++o) {
+        freelist_unlink(a, o, off + order_to_size(a, o));
+        a->stats.merges++;
+    }
+    set_block_order(a, off, want);
+    note_request(a, 1, new_size, order_to_size(a, want));
+    return true;
+} // change the block order without moving it, false when a copy is needed
+
+void buddy_init(allocator_t* a) {
     // clear each order free list
     // find the max num of blocks that can fit inside memory
-    // find largest power of two blocks, and set it equal gmo
-    // call free list
-    for (int i = 0; i < MAX_ORDERS; ++i) global_free_lists[i] = NULL; 
-    size_t blocks = global_memory_size / global_min_chunk_size; 
+    // find largest power of two blocks that fits, and set it equal gmo
+    // size the bitmaps of every order and take them from one host allocation
+    // seed the free lists with the largest aligned blocks that cover the region
+    for (int i = 0; i < MAX_ORDERS; ++i) {
+        a->free_lists[i] = NULL;
+        a->free_counts[i] = 0;
+        a->free_bits[i] = NULL;
+        a->free_summary[i] = NULL;
+        a->clean_bits[i] = NULL;
+        a->summary_words[i] = 0;
+    }
+    a->dirty_bytes = 0;
+    a->min_shift = __builtin_ctzll((unsigned long long)a->min_chunk_size);
+    a->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    a->page_order = size_to_order(a, a->page_size);
+    a->purge_order = MAX_ORDERS;                 // no automatic purge
+    if (a->purge_size) {
+        int o = size_to_order(a, next_powerof2(a->purge_size));
+        a->purge_order = o > a->page_order ? o : a->page_order;
+    }
+    size_t blocks = a->memory_size / a->min_chunk_size; 
     int maxorder = 0;
-    while ((size_t)(1ull << maxorder) < blocks && maxorder + 1 < MAX_ORDERS) maxorder++;
-    global_max_order = maxorder;
-    freelist_insert_sort(global_max_order, 0);
+    while (((size_t)2 << maxorder) <= blocks && maxorder + 1 < MAX_ORDERS) maxorder++;
+    a->max_order = maxorder;
+    a->nchunks = blocks;
+    if (blocks == 0) return;                     // not even one chunk, every pop fails
+
+    size_t total_words = 0;
+    for (int o = 0; o <= a->max_order; ++o) {
+        size_t nblocks = ((blocks - 1) >> o) + 1;      // the last one may only be partly inside
+        size_t words = (nblocks + 63) / 64;
+        a->summary_words[o] = (words + 63) / 64;
+        total_words += 2 * words + a->summary_words[o];
+    }
+    a->bitmap_storage = (uint64_t*)calloc(total_words, sizeof(uint64_t));
+    if (!a->bitmap_storage) {
+        for (int o = 0; o <= a->max_order; ++o) a->summary_words[o] = 0;   // every pop fails
+        return;
+    }
+    uint64_t* cursor = a->bitmap_storage;
+    for (int o = 0; o <= a->max_order; ++o) {
+        size_t nblocks = ((blocks - 1) >> o) + 1;
+        a->free_bits[o] = cursor;
+        cursor += (nblocks + 63) / 64;
+        a->free_summary[o] = cursor;
+        cursor += a->summary_words[o];
+        a->clean_bits[o] = cursor;
+        cursor += (nblocks + 63) / 64;
+    }
+    if (a->headerless) {                         // order of every allocated block, by first chunk
+        a->chunk_order = (uint8_t*)malloc(blocks);
+        if (!a->chunk_order) {
+            for (int o = 0; o <= a->max_order; ++o) a->summary_words[o] = 0;
+            return;
+        }
+        memset(a->chunk_order, CHUNK_FREE, blocks);
+    }
+
+    size_t off = 0;
+    while (off < blocks * a->min_chunk_size) {
+        int o = a->max_order;
+        while ((off & (order_to_size(a, o) - 1)) || !block_fits(a, off, o)) o--;
+        freelist_push(a, o, off, a->zeroed);
+        off += order_to_size(a, o);
+    }
 }
 
-void buddy_cleanup(void) {
-    // for each order list, we will start at the head of each list, save the next pointer, then free the current node
-    // we jump to the next node, and clear the head
+void buddy_cleanup(allocator_t* a) {
+    // the nodes live inside the managed memory, so only the bitmaps go back to the host
     for (int i = 0; i < MAX_ORDERS; ++i) {
-        free_node_t* current = global_free_lists[i];
-        while (current) {
-            free_node_t* nxt = current->next;
-            free(current);
-            current = nxt;
-        }
-        global_free_lists[i] = NULL;
+        a->free_lists[i] = NULL;
+        a->free_counts[i] = 0;
+        a->free_bits[i] = NULL;
+        a->free_summary[i] = NULL;
+        a->clean_bits[i] = NULL;
+        a->summary_words[i] = 0;
     }
+    free(a->bitmap_storage);
+    a->bitmap_storage = NULL;
+    free(a->chunk_order);
+    a->chunk_order = NULL;
 }
 
-// For slab we did not utilize bitmap for the slab pointer of the sdt as we are not familiar on how to implement them to the code.
-// Instead, we utilize a stack-based free list similar to the buddy allocator and uses pointer to navigate through the linked list
+static void slab_list_push(allocator_t* a, int slab_id, int list){
+    sdt *S = &a->slabs[slab_id];
+    slab_cache_t *c = &a->caches[S->cache];
+    S->list = list;
+    S->prev = -1;
+    S->next = c->heads[list];
+    if (S->next >= 0) a->slabs[S->next].prev = slab_id;
+    c->heads[list] = slab_id;
+    if (list == SLAB_EMPTY) c->nempty++;
+} // put the slab at the head of one of its cache lists
+
+static void slab_list_unlink(allocator_t* a, int slab_id){
+    sdt *S = &a->slabs[slab_id];
+    slab_cache_t *c = &a->caches[S->cache];
+    if (S->prev >= 0) a->slabs[S->prev].next = S->next;
+    else c->heads[S->list] = S->next;
+    if (S->next >= 0) a->slabs[S->next].prev = S->prev;
+    S->prev = S->next = -1;
+    if (S->list == SLAB_EMPTY) c->nempty--;
+} // take the slab off whatever list it is on
+
+static inline void slab_list_move(allocator_t* a, int slab_id, int list){
+    if (a->slabs[slab_id].list == list) return;
+    slab_list_unlink(a, slab_id);
+    slab_list_push(a, slab_id, list);
+}
 
-#ifndef MAX_SLABS
-#define MAX_SLABS 4096
-#endif
-                                    //
-typedef struct sdt {
-    size_t type_bytes;        // size of each obj in slab
-    size_t slab_size;         //size of the slab itself
-    int    objs_in_slab;        // should be = global_object_per_slab
-    int    used;            // no of objs in slab
+static inline size_t cache_hash_slot(size_t type_bytes){
+    return (size_t)((type_bytes * 0x9E3779B97F4A7C15ull) >> 32) % CACHE_HASH_SIZE;
+}
 
-    int    free_top;        // index for next free spot
-    size_t *free_offs;      // array holding the offsets
-    int    alive;           // 1 if alive, 0 if free
-    size_t slab_off;        // where slab start
-} sdt;
+static int cache_lookup(allocator_t* a, size_t type_bytes, bool create){
+    // buckets are only ever filled (release) after the cache is set up, so a lookup
+    // without create can run without the heap lock in thread safe mode
+    size_t h = cache_hash_slot(type_bytes);
+    int cid;
+    while ((cid = __atomic_load_n(&a->cache_hash[h], __ATOMIC_ACQUIRE)) >= 0) {   // linear probe, caches are never removed
+        if (a->caches[cid].type_bytes == type_bytes) return cid;
+        h = (h + 1) % CACHE_HASH_SIZE;
+    }
+    if (!create) return -1;
+    if (a->cache_count >= MAX_CACHES) {
+        __atomic_fetch_add(&a->stats.slab_meta_failures, 1, __ATOMIC_RELAXED);   // region.c reads it without the lock
+        return -1;
+    }
 
-static sdt slabs[MAX_SLABS];
-static int slab_count = 0;
+    cid = a->cache_count++;
+    slab_cache_t *c = &a->caches[cid];
+    c->type_bytes = type_bytes;
+    for (int l = 0; l < SLAB_NLISTS; ++l) c->heads[l] = -1;
+    c->nslabs = 0;
+    c->nempty = 0;
+    c->color = 0;
+    __atomic_store_n(&a->cache_hash[h], cid, __ATOMIC_RELEASE);
+    return cid;
+} // find the cache of this object size, optionally make it
+
+#ifdef SLAB_FREE_BITMAP
+static inline size_t slab_map_words(int cap){
+    return ((size_t)cap + 63) / 64;
+}
 
+static inline uint64_t* slab_map(allocator_t* a, sdt *S){
+    return (uint64_t*)offset_to_pointer(a, S->map_off);
+}
+#else
+static inline uint8_t* slab_obj(allocator_t* a, sdt *S, int idx){
+    return (uint8_t*)offset_to_pointer(a, S->slab_off) + S->obj_off + (size_t)idx * S->type_bytes;
+}
 
+static inline int obj_next_free(uint8_t* obj){
+    int32_t next;
+    memcpy(&next, obj, sizeof(next));              // objects are not aligned, so no direct load
+    return next;
+}
 
-static int make_slab(size_t type_bytes) {
-    int slab_id = -1;
-    for (int i = 0; i < slab_count; ++i) {           //find inactive slab to use
-         if (!slabs[i].alive) {
-            slab_id = i; break;
-        }
-     }
+static inline void obj_set_next_free(uint8_t* obj, int next){
+    int32_t v = next;
+    memcpy(obj, &v, sizeof(v));
+}
+#endif
 
-    if (slab_id < 0) {
-        if (slab_count >= MAX_SLABS)             //check if can make new one (slab_count< max_slabs)
-            return -1;
-        slab_id = slab_count++;
+static int slab_pop_free(allocator_t* a, sdt *S){
+#ifdef SLAB_FREE_BITMAP
+    uint64_t* map = slab_map(a, S);
+    size_t words = slab_map_words(S->objs_in_slab);
+    for (size_t w = 0; w < words; ++w) {
+        if (!map[w]) continue;
+        int bit = __builtin_ctzll(map[w]);
+        map[w] &= map[w] - 1;                     // clear lowest set bit
+        return (int)(w * 64) + bit;
+    }
+    return -1;
+#else
+    int idx = S->free_head;
+    if (idx >= 0) S->free_head = obj_next_free(slab_obj(a, S, idx));
+    return idx;
+#endif
+} // take one free object index out of the slab
+
+static bool slab_push_free(allocator_t* a, sdt *S, int idx){
+#ifdef SLAB_FREE_BITMAP
+    uint64_t* word = &slab_map(a, S)[idx >> 6];
+    uint64_t bit = (uint64_t)1 << (idx & 63);
+    if (*word & bit) return false;                // already free
+    *word |= bit;
+#else
+    obj_set_next_free(slab_obj(a, S, idx), S->free_head);
+    S->free_head = idx;
+#endif
+    return true;
+} // put the object index back as free
+
+static void slab_map_chunks(allocator_t* a, sdt *S, int value){
+    size_t first = S->slab_off >> a->min_shift;
+    size_t n = S->slab_size >> a->min_shift;
+    for (size_t i = 0; i < n; ++i) a->chunk_slab[first + i] = value;
+} // point the chunks covered by the slab at value in the header-less chunk map
+
+static inline int slab_id_of(allocator_t* a, void* user_ptr){
+    if (a->headerless) return a->chunk_slab[chunk_index(a, user_ptr)];
+    header_t* h = (header_t*)((uint8_t*)user_ptr - a->header_size);
+    return h->tag == TAG_SLAB ? (int)h->order : -1;
+} // owning slab of an object, from its header or from the chunk map, -1 for a plain buddy block
+
+// Cache line aware layout (MALLOC_F_SLAB_ALIGN)
+// Objects are padded so they do not straddle cache lines where the padding is cheap, and the
+// first user pointer of a slab sits on a line. Every new slab of a cache starts its objects
+// one line further into the slab tail slack than the last one (Bonwick's slab coloring), so
+// the first objects of different slabs do not all compete for the same cache sets.
+static inline size_t round_up(size_t n, size_t unit){
+    return (n + unit - 1) / unit * unit;
+}
+
+static size_t slab_stride(size_t type_bytes){
+    // a power of two up to a line, whole lines above that, as long as it wastes at most
+    // 1/SLAB_ALIGN_WASTE of the object; otherwise only natural (16 byte) alignment
+    size_t padded = type_bytes <= SLAB_LINE ? next_powerof2(type_bytes) : round_up(type_bytes, SLAB_LINE);
+    if ((padded - type_bytes) * SLAB_ALIGN_WASTE <= type_bytes) return padded;
+    return round_up(type_bytes, 16);
+}
+
+static int make_slab(allocator_t* a, int cache_id) {
+    if (a->sdt_free_top == 0) {           //check if can make new one
+        __atomic_fetch_add(&a->stats.slab_meta_failures, 1, __ATOMIC_RELAXED);   // region.c reads it without the lock
+        return -1;
     }
 
-    int cap = global_object_per_slab;
-    size_t bytes_slab_use = (size_t)cap * type_bytes;
-    void* slab_from_buddy = buddy_malloc(bytes_slab_use);    //#### use buddy allocator to give slab large enough for the memory
+    size_t type_bytes = a->caches[cache_id].type_bytes;
+    int cap = a->object_per_slab;
+    size_t obj_off = a->header_size;          // first object right after the slab's own header
+    if (a->slab_align) {
+        type_bytes = slab_stride(type_bytes);
+        size_t skew = (uintptr_t)a->base & (SLAB_LINE - 1);   // blocks are min chunk aligned from base, not absolutely
+        obj_off = round_up(skew + 2 * a->header_size, SLAB_LINE) - skew - a->header_size;   // first user pointer on a line
+    }
+    size_t bytes_slab_use = obj_off - a->header_size + (size_t)cap * type_bytes;
+#ifdef SLAB_FREE_BITMAP
+    size_t map_rel = (a->header_size + bytes_slab_use + 7) & ~(size_t)7;   // bitmap after the objects
+    bytes_slab_use = map_rel - a->header_size + slab_map_words(cap) * sizeof(uint64_t);
+#endif
+    bool clean;
+    void* slab_from_buddy = buddy_alloc(a, bytes_slab_use, &clean);    //#### use buddy allocator to give slab large enough for the memory
+    if (!slab_from_buddy && slab_shrink(a))                             // empty slabs of other caches first
+        slab_from_buddy = buddy_alloc(a, bytes_slab_use, &clean);
     if (!slab_from_buddy)
         return -1;
 
-    uint8_t* slab_start = (uint8_t*)slab_from_buddy - global_header_size;      //find the real slab start
-    header_t* hdr = (header_t*)slab_start;
-    size_t real_slab_size = ((size_t)global_min_chunk_size) << hdr->order;     // find the slab sizee
+    uint8_t* slab_start = (uint8_t*)slab_from_buddy - a->header_size;      //find the real slab start
+    size_t real_slab_size = order_to_size(a, block_order_of(a, slab_from_buddy));     // find the slab sizee
 
-    sdt *S = &slabs[slab_id];                  //creating a slab S and fill in the characteristic of that slab
+    int slab_id = a->sdt_free_ids[--a->sdt_free_top];  // pop an unused id
+    if (slab_id >= a->slab_count) a->slab_count = slab_id + 1;
+
+    sdt *S = &a->slabs[slab_id];                  //creating a slab S and fill in the characteristic of that slab
     *S = (sdt){0};                             //reset all field to zero first lol
     S->alive    = 1;
-    S->slab_off = pointer_to_offset(slab_start);
+    S->slab_off = pointer_to_offset(a, slab_start);
     S->slab_size = real_slab_size; 
     S->type_bytes = type_bytes;
     S->objs_in_slab = cap;
     S->used     = 0;
-    S->free_top = 0;
-    S->free_offs = (size_t*)malloc((size_t)cap * sizeof(size_t));          //create array to track of free object locations
- 
-    
-    if (!S->free_offs) {
-        buddy_free(slab_from_buddy);          //clean up if fail the array alloaction 
-        S->alive = 0;
-        return -1;
+    S->cache    = cache_id;
+    S->clean_from = clean ? 0 : cap;
+    if (a->slab_align) {                        // color: shift the objects into the tail slack
+        slab_cache_t *c = &a->caches[cache_id];
+        size_t slack = real_slab_size - a->header_size - bytes_slab_use;
+        if (c->color > slack) c->color = 0;
+        obj_off += c->color;
+#ifdef SLAB_FREE_BITMAP
+        map_rel += c->color;
+#endif
+        c->color += SLAB_LINE;
     }
+    S->obj_off = obj_off;
+
+#ifdef SLAB_FREE_BITMAP
+    S->map_off = S->slab_off + map_rel;         // every object starts free
+    uint64_t* map = slab_map(a, S);
+    for (size_t w = 0; w < slab_map_words(cap); ++w) map[w] = ~(uint64_t)0;
+    if (cap % 64) map[slab_map_words(cap) - 1] = ((uint64_t)1 << (cap % 64)) - 1;
+#else
+    S->free_head = -1;                          //thread the free list through all objs slots
+    for (int i = cap - 1; i >= 0; --i) slab_push_free(a, S, i);
+#endif
+    if (a->headerless) slab_map_chunks(a, S, slab_id);   // every chunk of the slab points back to it
+    a->caches[cache_id].nslabs++;
+    a->stats.slabs_created++;
+    slab_list_push(a, slab_id, SLAB_EMPTY);
+    return slab_id;               
+}
 
-    uint8_t* base = slab_start + global_header_size;         //fill the free list will all objs slots
-    for (int i = cap - 1; i >= 0; --i) {
-        S->free_offs[S->free_top++] = pointer_to_offset(base + (size_t)i * type_bytes);
+static void release_slab(allocator_t* a, int slab_id) {
+    sdt *s = &a->slabs[slab_id];
+    slab_list_unlink(a, slab_id);
+    a->caches[s->cache].nslabs--;
+    a->stats.slabs_destroyed++;
+    if (a->headerless) slab_map_chunks(a, s, -1);
+
+    uint8_t *slab_ptr = (uint8_t*)offset_to_pointer(a, s->slab_off);
+    buddy_free(a, slab_ptr + a->header_size);        //using buddy free to return the slab memory
+
+    s->alive = 0;                                  // reset back all slab
+    s->slab_off = 0;
+    s->type_bytes = 0;
+    s->objs_in_slab = 0;
+    s->used = 0;
+    a->sdt_free_ids[a->sdt_free_top++] = slab_id;        // id can be handed out again
+} // give the slab memory back to buddy and recycle its id
+
+static void slab_trim_empty(allocator_t* a, int cache_id) {
+    // hysteresis: once the cache holds more than slab_keep_empty empty slabs, release the
+    // oldest ones down to half of that, so a cache sitting right at the limit does not
+    // release and remake a slab on every other call
+    slab_cache_t *c = &a->caches[cache_id];
+    if (c->nempty <= a->slab_keep_empty) return;
+    int low = (a->slab_keep_empty + 1) / 2;
+    while (c->nempty > low) {
+        int id = c->heads[SLAB_EMPTY];               // newest first, the tail has been idle longest
+        while (a->slabs[id].next >= 0) id = a->slabs[id].next;
+        release_slab(a, id);
     }
-    return slab_id;               
 }
 
-void slab_init(void) {
+size_t slab_shrink(allocator_t* a) {
+    size_t released = 0;
+    for (int i = 0; i < a->cache_count; ++i) {
+        slab_cache_t *c = &a->caches[i];
+        while (c->heads[SLAB_EMPTY] >= 0) {
+            released += a->slabs[c->heads[SLAB_EMPTY]].slab_size;
+            release_slab(a, c->heads[SLAB_EMPTY]);
+        }
+    }
+    return released;
+} // release every empty slab kept for reuse, returns the bytes given back to buddy
+
+void slab_init(allocator_t* a) {
     for (int i = 0; i < MAX_SLABS; ++i) {            //helps initialize the slabs for other functions
-        slabs[i].alive = 0;
-        slabs[i].slab_off = 0;
-        slabs[i].type_bytes = 0;
-        slabs[i].objs_in_slab = 0;
+        a->slabs[i].alive = 0;
+        a->slabs[i].slab_off = 0;
+        a->slabs[i].type_bytes = 0;
+        a->slabs[i].objs_in_slab = 0;
 
-        slabs[i].used = 0;
-        slabs[i].free_top = 0;
-        slabs[i].free_offs = NULL;
+        a->slabs[i].used = 0;
+        a->slabs[i].prev = a->slabs[i].next = -1;
+    }
+    a->slab_count = 0;
+    a->sdt_free_top = 0;
+    for (int i = MAX_SLABS - 1; i >= 0; --i) a->sdt_free_ids[a->sdt_free_top++] = i;   // lowest id on top
+    a->cache_count = 0;
+    for (int i = 0; i < CACHE_HASH_SIZE; ++i) a->cache_hash[i] = -1;
+    size_classes_init(a);
+    if (a->mode_type == MALLOC_HYBRID && a->slab_max_size == 0)
+        a->slab_max_size = slab_default_max_size(a->memory_size, a->header_size, a->object_per_slab);
+    if (a->headerless) {                              // owning slab id of every chunk, -1 for none
+        size_t nchunks = a->nchunks;
+        a->chunk_slab = (int32_t*)malloc(nchunks * sizeof(int32_t));
+        if (!a->chunk_slab) {
+            a->sdt_free_top = 0;                      // no slab can be made
+            return;
+        }
+        for (size_t i = 0; i < nchunks; ++i) a->chunk_slab[i] = -1;
     }
-    slab_count = 0;
 }
 
-void* slab_malloc(int user_size) {
-    if (user_size <= 0) return NULL;
-
-    size_t type_bytes = (size_t)user_size + (size_t)global_header_size;   //add header for the user size
-
-    int slab_id = -1;     
-    for (int i = 0; i < slab_count; i++) {
-    sdt *s = &slabs[i];  //basically just checking if the objects size that the slab houses, matches our needed size                                                      
+// Size classes (size_class_steps > 0)
+// Object sizes (header included) are rounded up to a table of classes so nearby
+// requests share one cache. Below SIZE_CLASS_QUANTUM * steps the classes are one quantum
+// apart, above that every power of two is cut into `steps` equal classes, like jemalloc.
+// Each step is rounded up to the quantum, so with steps that are not a power of two the
+// classes stay quantum aligned too. The rounding wastes about 1/steps of an object at most.
+// Sizes above the last class are rounded to the same steps without the table, so big objects
+// do not get a cache (and a cache id) per exact size either.
+static void size_classes_init(allocator_t* a){
+    a->n_size_classes = 0;
+    int steps = a->size_class_steps;
+    if (steps <= 0) return;
+    if (steps > SIZE_CLASS_MAX_STEPS) steps = SIZE_CLASS_MAX_STEPS;
+    a->size_class_steps = steps;
+
+    size_t sz = SIZE_CLASS_QUANTUM;
+    size_t linear_end = (size_t)SIZE_CLASS_QUANTUM * (size_t)steps;
+    while (sz <= SIZE_CLASS_LIMIT && a->n_size_classes < MAX_SIZE_CLASSES) {
+        a->size_classes[a->n_size_classes++] = sz;
+        if (sz < linear_end) sz += SIZE_CLASS_QUANTUM;
+        else sz += (next_powerof2(sz + 1) / 2 / (size_t)steps + SIZE_CLASS_QUANTUM - 1) & ~(size_t)(SIZE_CLASS_QUANTUM - 1);   // group of the next power of two
+    }
 
-    if (!s->alive)
-        continue;   
-    if (s->type_bytes != type_bytes)
-        continue;   
-    if (s->free_top == 0)
-        continue;   
-    slab_id = i;    // found a good match
-    break;
+    int c = 0;                                   // direct map for small sizes, one entry per quantum
+    for (size_t i = 0; i <= SIZE_CLASS_SMALL_MAX / SIZE_CLASS_QUANTUM; ++i) {
+        size_t want = i * SIZE_CLASS_QUANTUM;
+        while (c < a->n_size_classes - 1 && a->size_classes[c] < want) c++;
+        a->small_class[i] = (uint16_t)c;
     }
+}
 
-    if (slab_id < 0) {                                    // if there is no suitable slab for that size, create new one!!
-        slab_id = make_slab(type_bytes); 
-        if (slab_id < 0) return NULL;
+static size_t size_class_round(allocator_t* a, size_t type_bytes){
+    if (a->n_size_classes == 0) return type_bytes;
+    if (type_bytes > a->size_classes[a->n_size_classes - 1]) {
+        size_t step = (next_powerof2(type_bytes) / 2 / (size_t)a->size_class_steps + SIZE_CLASS_QUANTUM - 1)
+                    & ~(size_t)(SIZE_CLASS_QUANTUM - 1);
+        return (type_bytes + step - 1) / step * step;
     }
+    if (type_bytes <= SIZE_CLASS_SMALL_MAX)
+        return a->size_classes[a->small_class[(type_bytes + SIZE_CLASS_QUANTUM - 1) / SIZE_CLASS_QUANTUM]];
+    int lo = 0, hi = a->n_size_classes - 1;     // first class >= type_bytes
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (a->size_classes[mid] < type_bytes) lo = mid + 1;
+        else hi = mid;
+    }
+    return a->size_classes[lo];
+}
+
+static inline size_t slab_type_bytes(allocator_t* a, size_t user_size){
+    size_t type_bytes = user_size + a->header_size;   //add header for the user size
+#ifndef SLAB_FREE_BITMAP
+    if (type_bytes < sizeof(int32_t)) type_bytes = sizeof(int32_t);        //a free object must hold its next link
+#endif
+    return size_class_round(a, type_bytes);
+}
+
+size_t slab_default_max_size(size_t memory_size, size_t header_size, int objs_per_slab){
+    size_t slab = memory_size / HYBRID_SLAB_FRACTION;               // biggest slab we want to see
+    size_t per = objs_per_slab > 0 ? slab / (size_t)objs_per_slab : 0;
+    return per > header_size ? per - header_size : 0;
+} // hybrid threshold when the config leaves it at 0
+
+static inline bool slab_serves(allocator_t* a, size_t user_size){
+    return a->mode_type == MALLOC_SLAB || user_size <= a->slab_max_size;
+} // hybrid mode sends the big requests to buddy
+
+int slab_size_class(allocator_t* a, size_t user_size, bool create) {
+    if (user_size == 0 || user_size > a->memory_size || !slab_serves(a, user_size)) return -1;
+    return cache_lookup(a, slab_type_bytes(a, user_size), create);
+}
 
-    sdt *S = &slabs[slab_id];                    //pointer S point to slab to allocate
-    size_t obj_off = S->free_offs [--S->free_top];                        // take the last free offset and decrsea free top 
+int slab_class_of_ptr(allocator_t* a, void* user_ptr) {
+    int sid = slab_id_of(a, user_ptr);
+    if (sid < 0) return -1;
+    return a->slabs[sid].cache;         // the slab stays alive while one of its objects is out
+}
+
+void* slab_malloc(allocator_t* a, size_t user_size) {
+    if (user_size == 0 || user_size > a->memory_size) return NULL;
+    if (!slab_serves(a, user_size)) return buddy_malloc(a, user_size);
+
+    int cache_id = cache_lookup(a, slab_type_bytes(a, user_size), true);
+    if (cache_id < 0) return NULL;
+    bool clean;
+    void* p = slab_alloc_obj(a, cache_id, &clean);
+    if (p) note_request(a, 1, user_size, a->caches[cache_id].type_bytes);
+    return p;
+}
+
+void* slab_malloc_class(allocator_t* a, int cache_id, size_t user_size) {
+    bool clean;
+    void* p = slab_alloc_obj(a, cache_id, &clean);
+    if (p) note_request(a, 1, user_size, a->caches[cache_id].type_bytes);
+    return p;
+}
+
+void* slab_calloc(allocator_t* a, size_t user_size) {
+    if (user_size == 0 || user_size > a->memory_size) return NULL;
+    if (!slab_serves(a, user_size)) return buddy_calloc(a, user_size);
+    int cache_id = cache_lookup(a, slab_type_bytes(a, user_size), true);
+    if (cache_id < 0) return NULL;
+    bool clean;
+    void* p = slab_alloc_obj(a, cache_id, &clean);
+    if (p) note_request(a, 1, user_size, a->caches[cache_id].type_bytes);
+    if (p) memset(p, 0, clean ? zero_prefix(user_size) : user_size);
+    return p;
+}
+
+static int slab_with_room(allocator_t* a, int cache_id) {
+    slab_cache_t *c = &a->caches[cache_id];
+    int slab_id = c->heads[SLAB_PARTIAL];              // any partial slab has room
+    if (slab_id < 0) slab_id = c->heads[SLAB_EMPTY];
+    if (slab_id < 0) slab_id = make_slab(a, cache_id);   // if there is no suitable slab for that size, create new one!!
+    if (slab_id < 0) a->stats.slab_failures++;
+    return slab_id;
+}
+
+static inline void* slab_take(allocator_t* a, int slab_id, bool* clean) {
+    sdt *S = &a->slabs[slab_id];                    //pointer S point to slab to allocate
+    int idx = slab_pop_free(a, S);                  // take a free object out of the slab
     S->used++;
+    a->stats.slab_allocs++;
+    *clean = idx >= S->clean_from;                  // never handed out from a never touched block
+    if (*clean) S->clean_from = idx + 1;
 
-    uint8_t* object_hdr = (uint8_t*)offset_to_pointer(obj_off);
+    uint8_t* object_hdr = (uint8_t*)offset_to_pointer(a, S->slab_off) + S->obj_off + (size_t)idx * S->type_bytes;
 
-    header_t* h = (header_t*)object_hdr;                 //write thos object_hdr at the start of mem block
-    h->order = (uint32_t)slab_id;
+    if (!a->headerless) {
+        header_t* h = (header_t*)object_hdr;                 //write thos object_hdr at the start of mem block
+        h->tag = TAG_SLAB;
+        h->order = (uint32_t)slab_id;
+    }
 
-    return object_hdr + global_header_size;               //return pointerr
+    return object_hdr + a->header_size;               //return pointerr
+} // one object out of a slab with room, the caller fixes the slab list
+
+static void* slab_alloc_obj(allocator_t* a, int cache_id, bool* clean) {
+    int slab_id = slab_with_room(a, cache_id);
+    if (slab_id < 0) return NULL;
+    void* p = slab_take(a, slab_id, clean);
+    sdt *S = &a->slabs[slab_id];
+    slab_list_move(a, slab_id, S->used == S->objs_in_slab ? SLAB_FULL : SLAB_PARTIAL);
+    return p;
+}
+
+int slab_malloc_batch(allocator_t* a, size_t user_size, int n, void** out) {
+    // one cache lookup for the whole batch, then drain a slab before touching its list
+    if (user_size == 0 || user_size > a->memory_size || n <= 0) return 0;
+    if (!slab_serves(a, user_size)) return buddy_malloc_batch(a, user_size, n, out);
+    int cache_id = cache_lookup(a, slab_type_bytes(a, user_size), true);
+    if (cache_id < 0) return 0;
+    bool clean;
+    int got = 0;
+    while (got < n) {
+        int slab_id = slab_with_room(a, cache_id);
+        if (slab_id < 0) break;
+        sdt *S = &a->slabs[slab_id];
+        while (got < n && S->used < S->objs_in_slab) out[got++] = slab_take(a, slab_id, &clean);
+        slab_list_move(a, slab_id, S->used == S->objs_in_slab ? SLAB_FULL : SLAB_PARTIAL);
+    }
+    note_request(a, got, user_size, a->caches[cache_id].type_bytes);
+    return got;
+}
+
+size_t slab_usable_size(allocator_t* a, void* user_ptr) {
+    int sid = slab_id_of(a, user_ptr);
+    if (sid < 0) return buddy_usable_size(a, user_ptr);
+    return a->slabs[sid].type_bytes - a->header_size;
 }
 
-void slab_free(void* user_ptr) {
+void* slab_memalign(allocator_t* a, size_t alignment, size_t user_size) {
+    // slab objects sit at header + idx * type_bytes, nothing lines them up,
+    // so aligned requests get their own buddy block; slab_free tells them apart
+    void* p = buddy_memalign(a, alignment, user_size);
+    if (!p && slab_shrink(a)) p = buddy_memalign(a, alignment, user_size);
+    return p;
+}
+
+void slab_free(allocator_t* a, void* user_ptr) {
     if (user_ptr == NULL) {
         return;
     }
 
-    uint8_t *object_hdr = (uint8_t*)user_ptr - global_header_size;
-
-    header_t *h = (header_t*)object_hdr;
+    uint8_t *object_hdr = (uint8_t*)user_ptr - a->header_size;
 
-    int sid = (int)h->order;
-    if (sid < 0) {
+    int sid = slab_id_of(a, user_ptr);
+    if (sid < 0) {                          // not a slab object, a memalign block from buddy
+        buddy_free(a, user_ptr);
         return;
     }
-    if (sid >= slab_count) {
+    if (sid >= a->slab_count) {
         return;
     }
 
-    sdt *s = &slabs[sid];   //getting pointer for that slab
+    sdt *s = &a->slabs[sid];   //getting pointer for that slab
     if (!s->alive) {
         return;
     }
 
-    uint8_t *slab_ptr = (uint8_t*)offset_to_pointer(s->slab_off);          //convert offset back to ptr
-    uint8_t *where_start = slab_ptr + global_header_size;
+    uint8_t *slab_ptr = (uint8_t*)offset_to_pointer(a, s->slab_off);          //convert offset back to ptr
+    uint8_t *where_start = slab_ptr + s->obj_off;
 
     size_t difference = (size_t)(object_hdr - where_start);    // compute how far obj hdr is from  the first obj hdr
     if ((difference % s->type_bytes) != 0) {
         return;
     }
 
-    if (s->free_top < s->objs_in_slab) {                        //pushing obj back into the free stack
-        size_t off = pointer_to_offset(object_hdr);         // store offset and bump the stack top
-        s->free_offs[s->free_top] = off;
-        s->free_top += 1;
+    int idx = (int)(difference / s->type_bytes);
+    if (idx >= s->objs_in_slab || s->used == 0) {
+        return;
     }
-
-    if (s->used > 0) {
-        s->used -= 1;
+    if (!slab_push_free(a, s, idx)) {                            //pushing obj back into the slab
+        return;
     }
-
-    if (s->used == 0) {                                      //return the empty slab memory back to buddy allocator
-        int all_free = (s->free_top == s->objs_in_slab);
-        if (all_free) {
-            buddy_free(where_start);
-
-            if (s->free_offs != NULL) {                      // free the array
-                free(s->free_offs);
-                s->free_offs = NULL;
-            }
-
-            s->alive = 0;                                  // reset back all slab
-            s->slab_off = 0;
-            s->type_bytes = 0;
-            s->objs_in_slab = 0;
-            s->free_top = 0;
-        }
+    s->used -= 1;
+    a->stats.slab_frees++;
+
+    if (s->used == 0) {
+        slab_list_move(a, sid, SLAB_EMPTY);
+        slab_trim_empty(a, s->cache);                          //keep it for reuse or return it back to buddy allocator
+    } else {
+        slab_list_move(a, sid, SLAB_PARTIAL);
     }
 }
 
+void slab_free_sized(allocator_t* a, void* user_ptr, size_t user_size) {
+    // the size only tells the buddy side of a hybrid heap apart, a slab object still
+    // finds its slab through the header (or the chunk map)
+    if (!slab_serves(a, user_size)) buddy_free_sized(a, user_ptr, user_size);
+    else slab_free(a, user_ptr);
+}
 
-void slab_cleanup(void) {
-    for (int i = 0; i < slab_count; i++) {           //kinda similar to slab_free
-        sdt *s = &slabs[i];
-        if (!s->alive)                             //skip empty slab
-            continue;
-
-        uint8_t *slab_ptr = (uint8_t *)offset_to_pointer(s->slab_off);
-        uint8_t *usable_ptr = slab_ptr + global_header_size;
-
-        buddy_free(usable_ptr);                  //using buddy free to return the slab memory
-
-        if (s->free_offs) {                      //free and null the offset
-            free(s->free_offs);
-            s->free_offs = NULL;
+void slab_cleanup(allocator_t* a) {
+    for (int i = 0; i < a->cache_count; i++) {           //walk every list of every cache
+        slab_cache_t *c = &a->caches[i];
+        for (int l = 0; l < SLAB_NLISTS; ++l) {
+            while (c->heads[l] >= 0) release_slab(a, c->heads[l]);
         }
-
-        s->alive = 0;                          //reset
-        s->slab_off = 0;
-        s->type_bytes = 0;
-        s->objs_in_slab = 0;
-        s->used = 0;
-        s->free_top = 0;
     }
 
-    slab_count = 0;
+    a->slab_count = 0;
+    a->cache_count = 0;
+    free(a->chunk_slab);
+    a->chunk_slab = NULL;
 }
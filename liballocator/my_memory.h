@@ -16,25 +16,321 @@
 
 // Declare your own data structures and functions here...
 // based on the main.c
-extern void* global_base; //RAM 
-extern size_t global_memory_size; // 8MB
-extern size_t global_header_size; //8
-extern size_t global_min_chunk_size; //512
-extern int global_object_per_slab; //64
-extern enum malloc_type global_mode_type;
-
-void* buddy_malloc(int user_size);
-void buddy_free(void* user_ptr);
-void* slab_malloc(int user_size);
-void slab_free(void* user_ptr);
-
 
 typedef struct {
     uint32_t tag;
     uint32_t order;
 } header_t;
 
-void buddy_init(void);
-void buddy_cleanup(void);
-void  slab_init(void);
-void  slab_cleanup(void);
+#define TAG_SMPL 0x534D504Cu     // marker header in front of a sampled allocation (profile.c)
+
+// Free blocks carry their own list node, so the free lists live inside the managed
+// region instead of in host malloc'd nodes. Next to each list we keep a bitmap per order
+// (one bit per block of that order) plus a summary word per 64 bitmap words. The bitmap
+// answers "is my buddy free?" in O(1) and finds the lowest free address with a ctz scan.
+typedef struct free_node {
+    struct free_node* next;
+    struct free_node* prev;
+} free_node_t;
+
+#define MAX_ORDERS 32
+#define CHUNK_FREE 0xFF                      // chunk_order entry of a chunk that starts no allocated block
+
+// Free objects of a slab are tracked inside the slab itself, there is no side array.
+// By default every free object stores the index of the next free object in its first
+// bytes, which gives the same LIFO reuse order the old offset stack had.
+// Building with -DSLAB_FREE_BITMAP keeps a bitmap (one bit per object) in the tail of
+// the slab block instead and hands out the lowest free object with a ctz scan.
+
+#ifndef MAX_SLABS
+#define MAX_SLABS 4096
+#endif
+
+#ifndef MAX_CACHES
+#define MAX_CACHES 1024
+#endif
+#define CACHE_HASH_SIZE (2 * MAX_CACHES)     // open addressing table, kept at most half full
+
+// every slab sits on exactly one list of its cache
+enum slab_list {
+    SLAB_PARTIAL = 0,   // some objects free, slab_malloc takes from here
+    SLAB_FULL = 1,      // no object free
+    SLAB_EMPTY = 2,     // every object free
+    SLAB_NLISTS = 3,
+};
+
+typedef struct sdt {
+    size_t type_bytes;        // size of each obj in slab
+    size_t slab_size;         //size of the slab itself
+    int    objs_in_slab;        // should be = object_per_slab
+    int    used;            // no of objs in slab
+
+#ifdef SLAB_FREE_BITMAP
+    size_t map_off;         // where the free bitmap starts (inside the slab block)
+#else
+    int    free_head;       // index of first free object, -1 when none
+#endif
+    int    alive;           // 1 if alive, 0 if free
+    size_t slab_off;        // where slab start
+    size_t obj_off;         // where the first object starts, from slab_off
+
+    int    clean_from;      // objects from this index on were never handed out of zeroed memory
+    int    cache;           // id of the cache that owns this slab
+    int    list;            // which list of the cache the slab is on
+    int    prev, next;      // neighbours on that list, -1 for none
+} sdt;
+
+// one cache per object size, each keeps its slabs split by how full they are
+typedef struct slab_cache {
+    size_t type_bytes;           // object size served by this cache
+    int    heads[SLAB_NLISTS];   // first slab id of partial/full/empty list, -1 for none
+    int    nslabs;               // slabs currently owned
+    int    nempty;               // of them on the empty list
+    size_t color;                // MALLOC_F_SLAB_ALIGN: object offset of the next slab, in the tail slack
+} slab_cache_t;
+
+// slab size classes
+#define SIZE_CLASS_QUANTUM 8
+#define SIZE_CLASS_MAX_STEPS 16
+#define SIZE_CLASS_LIMIT (64 * 1024)         // largest rounded object size
+#define SIZE_CLASS_SMALL_MAX 4096            // sizes up to here are mapped without a search
+#define MAX_SIZE_CLASSES 256
+
+// cache line aware slab layout (MALLOC_F_SLAB_ALIGN)
+#ifndef SLAB_LINE
+#define SLAB_LINE 64
+#endif
+#define SLAB_ALIGN_WASTE 4                   // pad to lines only when it costs at most 1/4 of the object
+
+// hybrid mode: with no slab_max_size given, a slab of the biggest slab served object takes
+// at most this fraction of the arena
+#ifndef HYBRID_SLAB_FRACTION
+#define HYBRID_SLAB_FRACTION 32
+#endif
+
+// thread cache sizing (tcache.c)
+#ifndef TCACHE_MAG_SIZE
+#define TCACHE_MAG_SIZE 32
+#endif
+#ifndef TCACHE_CLASSES
+#define TCACHE_CLASSES 64                 // slab caches with a higher id skip the thread cache
+#endif
+#define DEPOT_CAP (4 * TCACHE_MAG_SIZE)
+#ifndef TCACHE_REMOTE_CAP
+#define TCACHE_REMOTE_CAP (16 * TCACHE_MAG_SIZE)   // objects parked on a remote list before frees lock the heap
+#endif
+
+// sampling heap profiler (profile.c)
+#ifndef PROFILE_INTERVAL
+#define PROFILE_INTERVAL (512 * 1024)        // mean bytes between samples when the config gives none
+#endif
+#ifndef PROFILE_DEPTH
+#define PROFILE_DEPTH 32                     // frames kept per stack
+#endif
+#ifndef PROFILE_STACKS
+#define PROFILE_STACKS 1024                  // distinct stacks, later ones are lumped together
+#endif
+
+typedef struct profile profile_t;
+
+typedef struct depot {
+    pthread_mutex_t lock;
+    int             count;
+    void*           objs[DEPOT_CAP];
+    void*           remote;          // lock free list of freed objects, linked through their first word
+    int             remote_count;    // about how many are on it
+    int             mag_cap;         // objects per magazine of the class, -1 uncached, 0 not worked out yet
+} depot_t;
+
+struct tcache;
+
+// hot path counters, plain increments (in thread safe mode they are updated under heap_lock,
+// so thread cache hits do not show up)
+typedef struct alloc_counters {
+    uint64_t splits, merges;
+    uint64_t buddy_allocs, buddy_frees, buddy_failures;
+    uint64_t slab_allocs, slab_frees, slab_failures;
+    uint64_t slab_meta_failures;  // out of cache or slab ids, read by region.c to size a new region
+    uint64_t slabs_created, slabs_destroyed;
+    uint64_t requested_bytes;    // user bytes asked for
+    uint64_t granted_bytes;      // block / object bytes used for them
+    uint64_t header_bytes;       // part of granted_bytes taken by headers
+    uint64_t purges, purged_bytes;
+} alloc_counters_t;
+
+// growable heap (MALLOC_F_GROW): one child instance per mmap'd region
+#define MAX_REGIONS 64
+
+typedef struct region {
+    uintptr_t    start, end;
+    allocator_t* heap;
+} region_t;
+
+typedef struct region_table {
+    int                  n;
+    region_t             r[MAX_REGIONS];        // sorted by start
+    struct region_table* retired;               // the table this one replaced
+} region_table_t;
+
+// One heap. Everything my_setup() used to keep in process wide globals lives here,
+// so several independent heaps can exist side by side.
+struct allocator {
+    // configuration
+    enum malloc_type mode_type;
+    void*  base;                 // RAM
+    size_t memory_size;          // 8MB
+    size_t header_size;          // 8
+    size_t min_chunk_size;       // 512
+    int    object_per_slab;      // 64
+    bool   thread_safe;
+    bool   zeroed;               // start_of_memory was zero filled
+    bool   slab_align;           // MALLOC_F_SLAB_ALIGN
+    alloc_counters_t stats;
+
+    // sampling (MALLOC_F_PROFILE), thread safe heaps count per thread in the thread cache
+    int64_t    sample_left;          // bytes until the next sampled malloc
+    profile_t* profile;              // NULL when sampling is off
+
+    // buddy
+    free_node_t* free_lists[MAX_ORDERS];
+    size_t       free_counts[MAX_ORDERS];
+    uint64_t*    free_bits[MAX_ORDERS];      // bit i set -> block i of this order is free
+    uint64_t*    free_summary[MAX_ORDERS];   // bit w set -> free_bits word w is non zero
+    uint64_t*    clean_bits[MAX_ORDERS];     // bit i set -> free block i reads as zero past its node
+    size_t       summary_words[MAX_ORDERS];
+    uint64_t*    bitmap_storage;             // one host allocation for every bitmap
+    int          max_order;
+    int          min_shift;                  // log2(min_chunk_size)
+    size_t       nchunks;                    // whole min chunks in the region, the rest of it is unused
+
+    // purging: dirty free blocks of purge_order and up go back to the OS past purge_dirty_max
+    size_t       purge_size;                 // from the config, 0 = only alloc_trim() purges
+    size_t       purge_dirty_max;
+    int          purge_order;                // MAX_ORDERS when there is no automatic purge
+    size_t       dirty_bytes;                // dirty free bytes in blocks of purge_order and up
+    size_t       page_size;
+    int          page_order;                 // smallest order that covers a page
+
+    // header-less mode: metadata is found from the address, one entry per min chunk
+    bool         headerless;
+    uint8_t*     chunk_order;                // order of the allocated buddy block starting here
+    int32_t*     chunk_slab;                 // slab that owns this chunk, -1 for none
+
+    // slab
+    sdt          slabs[MAX_SLABS];
+    int          slab_count;                 // high water mark of slab ids handed out
+    int          sdt_free_ids[MAX_SLABS];    // stack of unused slab ids
+    int          sdt_free_top;
+    slab_cache_t caches[MAX_CACHES];
+    int          cache_count;
+    int          cache_hash[CACHE_HASH_SIZE];   // type_bytes -> cache id, -1 for empty bucket
+    int          size_class_steps;           // classes per power of two, 0 keeps exact sizes
+    int          slab_keep_empty;            // empty slabs a cache keeps before releasing, 0 = none
+    size_t       slab_max_size;              // hybrid: bigger requests go straight to buddy
+    int          n_size_classes;
+    size_t       size_classes[MAX_SIZE_CLASSES];
+    uint16_t     small_class[SIZE_CLASS_SMALL_MAX / SIZE_CLASS_QUANTUM + 1];
+
+    // thread safe mode
+    pthread_mutex_t heap_lock;               // guards buddy and slab
+    pthread_key_t   tcache_key;
+    struct tcache*  tcache_all;              // every thread cache, protected by heap_lock
+    depot_t         depots[TCACHE_CLASSES];
+
+    // growable mode: the instance only routes calls to its regions, heap_lock guards growth
+    bool            growable;
+    alloc_config_t  grow_config;             // child configuration, start/size filled per region
+    size_t          max_memory_size;         // 0 = no limit
+    size_t          grow_last;               // size of the newest region
+    uint64_t        grow_meta_seen;          // out of ids failures of the children at the last growth
+    region_table_t* regions;
+    allocator_t*    region_hint;             // region that served the last request
+    size_t          region_failed;           // child: smallest request it failed since its last free, 0 none
+};
+
+extern allocator_t* default_allocator;  // the instance behind my_setup()/my_malloc()/my_free()
+
+void* buddy_malloc(allocator_t* a, size_t user_size);
+void buddy_free(allocator_t* a, void* user_ptr);
+void* slab_malloc(allocator_t* a, size_t user_size);
+void slab_free(allocator_t* a, void* user_ptr);
+
+// sized free, user_size is the malloc request of a block that is no memalign one
+void buddy_free_sized(allocator_t* a, void* user_ptr, size_t user_size);
+void slab_free_sized(allocator_t* a, void* user_ptr, size_t user_size);
+
+// batches, same result as n single calls
+int buddy_malloc_batch(allocator_t* a, size_t user_size, int n, void** out);
+int slab_malloc_batch(allocator_t* a, size_t user_size, int n, void** out);
+
+// calloc / memalign
+void* buddy_calloc(allocator_t* a, size_t user_size);
+void* buddy_memalign(allocator_t* a, size_t alignment, size_t user_size);
+void* slab_calloc(allocator_t* a, size_t user_size);
+void* slab_memalign(allocator_t* a, size_t alignment, size_t user_size);
+
+size_t slab_default_max_size(size_t memory_size, size_t header_size, int objs_per_slab);
+
+// empty slabs kept for reuse
+size_t slab_shrink(allocator_t* a);
+
+// realloc support
+size_t buddy_usable_size(allocator_t* a, void* user_ptr);
+size_t buddy_purge(allocator_t* a, int min_order);
+bool buddy_resize_in_place(allocator_t* a, void* user_ptr, size_t new_size);
+size_t slab_usable_size(allocator_t* a, void* user_ptr);
+
+// size classes, used by the thread cache: buddy classes are block orders, slab classes are cache ids
+int buddy_size_class(allocator_t* a, size_t user_size);
+size_t buddy_class_size(allocator_t* a, int order);
+void* buddy_malloc_class(allocator_t* a, int order, size_t user_size);   // user_size only feeds the counters
+int buddy_class_of_ptr(allocator_t* a, void* user_ptr);
+int slab_size_class(allocator_t* a, size_t user_size, bool create);
+void* slab_malloc_class(allocator_t* a, int cache_id, size_t user_size);
+int slab_class_of_ptr(allocator_t* a, void* user_ptr);
+
+void buddy_init(allocator_t* a);
+void buddy_cleanup(allocator_t* a);
+void  slab_init(allocator_t* a);
+void  slab_cleanup(allocator_t* a);
+
+// thread cache (tcache.c)
+void  tcache_init(allocator_t* a);
+void  tcache_cleanup(allocator_t* a);
+void* tcache_malloc(allocator_t* a, size_t size);
+void* tcache_malloc_unsampled(allocator_t* a, size_t size);
+void  tcache_free(allocator_t* a, void* user_ptr);
+void  tcache_free_sized(allocator_t* a, void* user_ptr, size_t size);
+void  tcache_flush(allocator_t* a);     // caller's magazines, depots and remote lists back to the heap
+
+// unsampled malloc/free of the instance (interface.c), the profiler wraps these
+void* heap_malloc(allocator_t* a, size_t size);
+void  heap_free(allocator_t* a, void* user_ptr);
+
+// sampling heap profiler (profile.c)
+void    profile_init(allocator_t* a, const alloc_config_t* config);
+void    profile_cleanup(allocator_t* a);
+void    profile_reset(allocator_t* a);
+int64_t profile_next_gap(allocator_t* a);
+void*   profile_malloc(allocator_t* a, int64_t* left, size_t size);
+void    profile_free(allocator_t* a, void* user_ptr);
+void*   profile_realloc(allocator_t* a, void* user_ptr, size_t size);
+size_t  profile_usable_size(allocator_t* a, void* user_ptr);
+
+static inline bool profile_sampled(allocator_t* a, void* user_ptr){
+    return a->profile && ((header_t*)((char*)user_ptr - a->header_size))->tag == TAG_SMPL;
+} // user_ptr came from profile_malloc()
+
+// growable heap (region.c)
+void  region_init(allocator_t* a, const alloc_config_t* config);
+void  region_cleanup(allocator_t* a);
+void  region_reset(allocator_t* a);
+size_t region_trim(allocator_t* a);
+size_t region_shrink(allocator_t* a);
+void* region_malloc(allocator_t* a, size_t size);
+void* region_calloc(allocator_t* a, size_t size);
+void* region_memalign(allocator_t* a, size_t alignment, size_t size);
+void* region_realloc(allocator_t* a, void* ptr, size_t size);
+int   region_malloc_batch(allocator_t* a, size_t size, int n, void** out);
+void  region_free(allocator_t* a, void* ptr);
+void  region_free_sized(allocator_t* a, void* ptr, size_t size);
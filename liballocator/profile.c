@@ -0,0 +1,282 @@
+#include <execinfo.h>
+#include <fcntl.h>
+
+#include "my_memory.h"
+
+// Sampling heap profiler (MALLOC_F_PROFILE)
+// The malloc fast path counts bytes down (a->sample_left, or the thread cache's own counter
+// in thread safe mode) and only when the counter goes negative we get here. The gaps between
+// samples are exponentially distributed with a mean of sample_interval bytes, so every byte
+// has the same chance to be sampled no matter how the sizes line up. A sampled allocation gets
+// pad extra bytes in front: its request size, then a TAG_SMPL marker header right before the
+// user pointer (the same trick memalign uses), holding the id of its call stack. free() sees
+// the marker, takes the object off the live counts of its stack and frees the real block.
+
+#define PROFILE_SKIP 1                 // frames of the profiler itself at the top of a stack
+
+typedef struct profile_stack {
+    uint64_t hash;                     // 0 for an unused slot
+    int      depth;
+    void*    pcs[PROFILE_DEPTH];
+    uint64_t live_objs, live_bytes;    // sampled objects not freed yet
+    uint64_t total_objs, total_bytes;  // every sample since setup
+} profile_stack_t;
+
+struct profile {
+    pthread_mutex_t lock;              // stacks, rng
+    size_t          interval;          // mean bytes between two samples
+    size_t          pad;               // bytes in front of a sampled user pointer
+    uint64_t        rng;
+    int             nstacks;
+    profile_stack_t stacks[PROFILE_STACKS + 1];   // open addressing by hash, the last slot takes the overflow
+};
+
+static inline uint64_t stack_hash(void* const* pcs, int depth){
+    uint64_t h = 0xcbf29ce484222325ull;        // FNV-1a over the return addresses
+    for (int i = 0; i < depth; ++i) h = (h ^ (uint64_t)(uintptr_t)pcs[i]) * 0x100000001b3ull;
+    return h | 1;
+}
+
+static int stack_slot(profile_t* p, void* const* pcs, int depth){
+    // caller holds p->lock; once the table is 3/4 full new stacks share the overflow slot
+    uint64_t h = stack_hash(pcs, depth);
+    for (int i = (int)(h % PROFILE_STACKS);; i = (i + 1) % PROFILE_STACKS) {
+        profile_stack_t* s = &p->stacks[i];
+        if (s->hash == h && s->depth == depth && !memcmp(s->pcs, pcs, (size_t)depth * sizeof(void*)))
+            return i;
+        if (s->hash) continue;
+        if (p->nstacks >= PROFILE_STACKS / 4 * 3) return PROFILE_STACKS;
+        s->hash = h;
+        s->depth = depth;
+        memcpy(s->pcs, pcs, (size_t)depth * sizeof(void*));
+        p->nstacks++;
+        return i;
+    }
+} // slot of this call stack, made on first use
+
+static inline size_t round_up16(size_t n){
+    return (n + 15) & ~(size_t)15;
+}
+
+void profile_init(allocator_t* a, const alloc_config_t* config){
+    // sampled objects need a header to carry the marker
+    a->profile = NULL;
+    if (!(config->flags & MALLOC_F_PROFILE) || a->headerless || a->header_size < sizeof(header_t)) return;
+    profile_t* p = (profile_t*)calloc(1, sizeof(profile_t));
+    if (!p) return;
+    pthread_mutex_init(&p->lock, NULL);
+    p->interval = config->sample_interval ? config->sample_interval : PROFILE_INTERVAL;
+    p->pad = round_up16(a->header_size + sizeof(uint64_t));      // keeps the user pointer's alignment
+    p->rng = 0x9E3779B97F4A7C15ull ^ (uint64_t)(uintptr_t)a;
+    a->profile = p;
+}
+
+void profile_cleanup(allocator_t* a){
+    if (!a->profile) return;
+    pthread_mutex_destroy(&a->profile->lock);
+    free(a->profile);
+    a->profile = NULL;
+}
+
+void profile_reset(allocator_t* a){
+    // every allocation is gone, the cumulative counts stay
+    profile_t* p = a->profile;
+    if (!p) return;
+    pthread_mutex_lock(&p->lock);
+    for (int i = 0; i <= PROFILE_STACKS; ++i) p->stacks[i].live_objs = p->stacks[i].live_bytes = 0;
+    pthread_mutex_unlock(&p->lock);
+}
+
+int64_t profile_next_gap(allocator_t* a){
+    profile_t* p = a->profile;
+    if (!p) return INT64_MAX;                  // never runs out in practice
+    pthread_mutex_lock(&p->lock);
+    p->rng ^= p->rng >> 12;                    // xorshift64*
+    p->rng ^= p->rng << 25;
+    p->rng ^= p->rng >> 27;
+    uint64_t r = p->rng * 2685821657736338717ull;
+    pthread_mutex_unlock(&p->lock);
+    double u = (double)((r >> 11) + 1) / 9007199254740992.0;   // (0, 1]
+    double gap = -log(u) * (double)p->interval;
+    return gap >= (double)INT64_MAX ? INT64_MAX : (int64_t)gap + 1;
+} // bytes until the next sample
+
+static inline uint64_t* sampled_size(profile_t* p, void* user_ptr){
+    return (uint64_t*)((char*)user_ptr - p->pad);
+}
+
+void* profile_malloc(allocator_t* a, int64_t* left, size_t size){
+    // *left went negative: this allocation is the sample, then draw the next gap
+    *left = profile_next_gap(a);
+    profile_t* p = a->profile;
+    if (!p || size == 0 || size > SIZE_MAX - p->pad) return heap_malloc(a, size);
+
+    void* pcs[PROFILE_DEPTH + PROFILE_SKIP];
+    int depth = backtrace(pcs, PROFILE_DEPTH + PROFILE_SKIP) - PROFILE_SKIP;
+    if (depth < 0) depth = 0;
+
+    char* block = (char*)heap_malloc(a, size + p->pad);
+    if (!block) return NULL;
+    void* user_ptr = block + p->pad;
+    pthread_mutex_lock(&p->lock);
+    int id = stack_slot(p, pcs + PROFILE_SKIP, depth);
+    profile_stack_t* s = &p->stacks[id];
+    s->live_objs++;
+    s->live_bytes += size;
+    s->total_objs++;
+    s->total_bytes += size;
+    pthread_mutex_unlock(&p->lock);
+
+    *sampled_size(p, user_ptr) = size;
+    header_t* mark = (header_t*)((char*)user_ptr - a->header_size);
+    mark->tag = TAG_SMPL;
+    mark->order = (uint32_t)id;
+    return user_ptr;
+}
+
+void profile_free(allocator_t* a, void* user_ptr){
+    // caller checked profile_sampled()
+    profile_t* p = a->profile;
+    header_t* mark = (header_t*)((char*)user_ptr - a->header_size);
+    uint64_t size = *sampled_size(p, user_ptr);
+    pthread_mutex_lock(&p->lock);
+    profile_stack_t* s = &p->stacks[mark->order <= PROFILE_STACKS ? mark->order : PROFILE_STACKS];
+    if (s->live_objs) {
+        s->live_objs--;
+        s->live_bytes -= size;
+    }
+    pthread_mutex_unlock(&p->lock);
+    mark->tag = 0;                             // a second free of it finds no marker
+    heap_free(a, (char*)user_ptr - p->pad);
+}
+
+size_t profile_usable_size(allocator_t* a, void* user_ptr){
+    void* block = (char*)user_ptr - a->profile->pad;
+    if (a->thread_safe) pthread_mutex_lock(&a->heap_lock);
+    size_t usable = a->mode_type == MALLOC_BUDDY ? buddy_usable_size(a, block) : slab_usable_size(a, block);
+    if (a->thread_safe) pthread_mutex_unlock(&a->heap_lock);
+    return usable - a->profile->pad;
+}
+
+void* profile_realloc(allocator_t* a, void* user_ptr, size_t size){
+    // sampled objects always move, the free of the old one retires it
+    size_t old = profile_usable_size(a, user_ptr);
+    void* moved = alloc_malloc(a, size);
+    if (!moved) return NULL;
+    memcpy(moved, user_ptr, old < size ? old : size);
+    profile_free(a, user_ptr);
+    return moved;
+}
+
+// Dumps
+// The stacks of the instance (or of every region of a growable one) are merged into one
+// snapshot first, so the locks are not held while writing. The pprof format is the legacy
+// heap profile text (heap_v2) that pprof reads and unsamples itself; the plain text one
+// shows the unsampled estimates with symbolized stacks.
+
+static void profile_merge(profile_t* out, profile_t* in){
+    pthread_mutex_lock(&in->lock);
+    out->interval = in->interval;
+    for (int i = 0; i <= PROFILE_STACKS; ++i) {
+        profile_stack_t* s = &in->stacks[i];
+        if (!s->total_objs) continue;
+        profile_stack_t* o = &out->stacks[i == PROFILE_STACKS ? PROFILE_STACKS : stack_slot(out, s->pcs, s->depth)];
+        o->live_objs += s->live_objs;
+        o->live_bytes += s->live_bytes;
+        o->total_objs += s->total_objs;
+        o->total_bytes += s->total_bytes;
+    }
+    pthread_mutex_unlock(&in->lock);
+}
+
+static int cmp_live_bytes(const void* x, const void* y){
+    const profile_stack_t* a = *(profile_stack_t* const*)x;
+    const profile_stack_t* b = *(profile_stack_t* const*)y;
+    return a->live_bytes < b->live_bytes ? 1 : a->live_bytes > b->live_bytes ? -1 : 0;
+}
+
+static double unsample(uint64_t objs, uint64_t bytes, size_t interval){
+    // a sample of average size s stands for 1 / (1 - e^(-s/interval)) allocations like it
+    if (!objs) return 0;
+    double avg = (double)bytes / (double)objs;
+    return 1.0 / (1.0 - exp(-avg / (double)interval));
+}
+
+static void dump_pprof(profile_t* p, profile_stack_t** order, int n, int fd){
+    uint64_t lo = 0, lb = 0, to = 0, tb = 0;
+    for (int i = 0; i < n; ++i) {
+        lo += order[i]->live_objs;
+        lb += order[i]->live_bytes;
+        to += order[i]->total_objs;
+        tb += order[i]->total_bytes;
+    }
+    dprintf(fd, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%zu\n",
+            (unsigned long long)lo, (unsigned long long)lb, (unsigned long long)to, (unsigned long long)tb, p->interval);
+    for (int i = 0; i < n; ++i) {
+        profile_stack_t* s = order[i];
+        dprintf(fd, "%llu: %llu [%llu: %llu] @", (unsigned long long)s->live_objs, (unsigned long long)s->live_bytes,
+                (unsigned long long)s->total_objs, (unsigned long long)s->total_bytes);
+        for (int k = 0; k < s->depth; ++k) dprintf(fd, " %p", s->pcs[k]);
+        dprintf(fd, "\n");
+    }
+
+    dprintf(fd, "\nMAPPED_LIBRARIES:\n");               // lets pprof symbolize the addresses
+    int maps = open("/proc/self/maps", O_RDONLY);
+    char buf[4096];
+    ssize_t got;
+    while (maps >= 0 && (got = read(maps, buf, sizeof(buf))) > 0)
+        if (write(fd, buf, (size_t)got) != got) break;
+    if (maps >= 0) close(maps);
+}
+
+static void dump_text(profile_t* p, profile_stack_t** order, int n, int fd){
+    double lb = 0, tb = 0;
+    for (int i = 0; i < n; ++i) {
+        lb += (double)order[i]->live_bytes * unsample(order[i]->live_objs, order[i]->live_bytes, p->interval);
+        tb += (double)order[i]->total_bytes * unsample(order[i]->total_objs, order[i]->total_bytes, p->interval);
+    }
+    dprintf(fd, "heap profile: one sample per %zu bytes, %d stacks\n", p->interval, n);
+    dprintf(fd, "estimated live %.0f bytes, allocated %.0f bytes\n", lb, tb);
+    for (int i = 0; i < n; ++i) {
+        profile_stack_t* s = order[i];
+        double ls = unsample(s->live_objs, s->live_bytes, p->interval);
+        double ts = unsample(s->total_objs, s->total_bytes, p->interval);
+        dprintf(fd, "\n#%d live %.0f bytes in %.0f objects, allocated %.0f bytes in %.0f objects (%llu/%llu samples)\n",
+                i + 1, (double)s->live_bytes * ls, (double)s->live_objs * ls, (double)s->total_bytes * ts,
+                (double)s->total_objs * ts, (unsigned long long)s->live_objs, (unsigned long long)s->total_objs);
+        if (s->depth) backtrace_symbols_fd(s->pcs, s->depth, fd);
+        else dprintf(fd, "(stacks past PROFILE_STACKS)\n");
+    }
+}
+
+int alloc_profile_dump(allocator_t* a, int fd, enum malloc_profile_format format){
+    profile_t* snap = (profile_t*)calloc(1, sizeof(profile_t));
+    profile_stack_t** order = (profile_stack_t**)malloc((PROFILE_STACKS + 1) * sizeof(profile_stack_t*));
+    int rc = -1;
+    if (!snap || !order) goto out;
+
+    if (a->growable) {
+        const region_table_t* t = __atomic_load_n(&a->regions, __ATOMIC_ACQUIRE);
+        for (int i = 0; t && i < t->n; ++i)
+            if (t->r[i].heap->profile) profile_merge(snap, t->r[i].heap->profile);
+    } else if (a->profile) {
+        profile_merge(snap, a->profile);
+    }
+    if (!snap->interval) goto out;             // sampling is off
+
+    int n = 0;
+    for (int i = 0; i <= PROFILE_STACKS; ++i)
+        if (snap->stacks[i].total_objs) order[n++] = &snap->stacks[i];
+    qsort(order, (size_t)n, sizeof(*order), cmp_live_bytes);
+    if (format == MALLOC_PROFILE_PPROF) dump_pprof(snap, order, n, fd);
+    else dump_text(snap, order, n, fd);
+    rc = 0;
+out:
+    free(order);
+    free(snap);
+    return rc;
+} // -1 when sampling is off or out of host memory
+
+int my_profile_dump(int fd, enum malloc_profile_format format){
+    return alloc_profile_dump(default_allocator, fd, format);
+}
@@ -0,0 +1,314 @@
+#include <sys/mman.h>
+
+#include "my_memory.h"
+
+// Growable heap (MALLOC_F_GROW)
+// The instance owns no memory itself. Every region is an mmap'd block with its own child
+// instance (its own base, so pointer_to_offset() stays region relative). When no region can
+// serve a request a new one is mapped, twice as big as the last one or as big as the request
+// needs. free() finds the region with a binary search over a table sorted by address; the
+// table is replaced as a whole when a region is added, so lookups never take a lock.
+// A child remembers the smallest request it failed since its last free, so misses do not
+// try regions that surely can not serve them (a slab child only skips that same size).
+// Before a region is mapped, every child gives its empty slabs (and in thread safe mode its
+// cached objects) back to buddy and all of them are tried once more.
+// Every child has its own fixed set of cache and slab ids (MAX_CACHES, MAX_SLABS). When a
+// child failed for want of ids rather than memory, the new region is only as big as the
+// first one (or the request) and the doubling goes on from the last region grown for memory.
+
+#define REGION_MAX_REQUEST (SIZE_MAX / 8)     // keeps the region size math from overflowing
+
+#ifndef REGION_GROW_MAX
+#define REGION_GROW_MAX ((size_t)256 << 20)     // doubling stops here, bigger regions only for bigger requests
+#endif
+
+static inline const region_table_t* regions_of(allocator_t* a){
+    return __atomic_load_n(&a->regions, __ATOMIC_ACQUIRE);
+}
+
+static allocator_t* region_of_ptr(allocator_t* a, void* ptr){
+    const region_table_t* t = regions_of(a);
+    uintptr_t p = (uintptr_t)ptr;
+    int lo = 0, hi = t ? t->n - 1 : -1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (p < t->r[mid].start) hi = mid - 1;
+        else if (p >= t->r[mid].end) lo = mid + 1;
+        else return t->r[mid].heap;
+    }
+    return NULL;
+} // child instance whose region holds ptr, NULL for a foreign pointer
+
+static size_t region_need(allocator_t* a, size_t size){
+    // smallest region that surely serves one request of this size: a slab holds
+    // object_per_slab objects, each rounded up at most to twice its size by the size classes
+    size_t per = size + a->header_size;
+    bool slab = a->mode_type == MALLOC_SLAB || (a->mode_type == MALLOC_HYBRID && size <= a->slab_max_size);
+    size_t count = slab ? 2 * (size_t)a->object_per_slab : 1;
+    if (size > REGION_MAX_REQUEST || per > (SIZE_MAX / 4 - a->header_size) / count) return SIZE_MAX;
+    size_t need = per * count + a->header_size;
+    size_t region = a->min_chunk_size;
+    while (region < need) region <<= 1;
+    return region;
+}
+
+static bool region_full(allocator_t* a, allocator_t* heap, size_t size){
+    size_t failed = __atomic_load_n(&heap->region_failed, __ATOMIC_RELAXED);
+    return failed && (a->mode_type == MALLOC_BUDDY ? size >= failed : size == failed);
+} // a buddy child that failed a size fails every bigger one too, slab caches only for that size
+
+static void region_mark_full(allocator_t* a, allocator_t* heap, size_t size){
+    size_t failed = __atomic_load_n(&heap->region_failed, __ATOMIC_RELAXED);
+    if (!failed || a->mode_type != MALLOC_BUDDY || size < failed)
+        __atomic_store_n(&heap->region_failed, size, __ATOMIC_RELAXED);
+}
+
+static inline void region_mark_freed(allocator_t* heap){
+    if (__atomic_load_n(&heap->region_failed, __ATOMIC_RELAXED))
+        __atomic_store_n(&heap->region_failed, 0, __ATOMIC_RELAXED);
+}
+
+static uint64_t region_meta_failures(const region_table_t* t){
+    uint64_t n = 0;
+    for (int i = 0; t && i < t->n; ++i) n += __atomic_load_n(&t->r[i].heap->stats.slab_meta_failures, __ATOMIC_RELAXED);
+    return n;
+} // failures of the children that were out of cache or slab ids, not memory
+
+static bool region_add(allocator_t* a, size_t size, bool out_of_ids){
+    // caller holds heap_lock
+    const region_table_t* old = a->regions;
+    int n = old ? old->n : 0;
+    if (n == MAX_REGIONS) return false;
+
+    size_t bytes = !n || out_of_ids ? a->grow_config.memory_size : a->grow_last * 2;
+    if (n && bytes > REGION_GROW_MAX) bytes = REGION_GROW_MAX;
+    size_t need = region_need(a, size);
+    if (need == SIZE_MAX) return false;
+    if (bytes < need) bytes = need;
+    if (a->max_memory_size && a->memory_size + bytes > a->max_memory_size) {
+        if (a->memory_size + need > a->max_memory_size) return false;
+        bytes = a->max_memory_size - a->memory_size;       // whatever is left under the cap
+    }
+
+    void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) return false;
+    alloc_config_t config = a->grow_config;
+    config.start_of_memory = mem;
+    config.memory_size = bytes;
+    config.flags = (config.flags & ~MALLOC_F_GROW) | MALLOC_F_ZEROED;   // fresh mappings read as zero
+    allocator_t* heap = alloc_create(&config);
+    region_table_t* t = (region_table_t*)malloc(sizeof(region_table_t));
+    if (!heap || !t) {
+        if (heap) alloc_destroy(heap);
+        free(t);
+        munmap(mem, bytes);
+        return false;
+    }
+
+    // copy the old table with the new region sorted in, then publish it
+    region_t r = {(uintptr_t)mem, (uintptr_t)mem + bytes, heap};
+    int k = 0;
+    for (int i = 0; i < n; ++i) {
+        if (k == i && old->r[i].start > r.start) t->r[k++] = r;
+        t->r[k++] = old->r[i];
+    }
+    if (k == n) t->r[k++] = r;
+    t->n = k;
+    t->retired = (region_table_t*)old;        // readers may still hold it, freed with the instance
+    if (!out_of_ids) a->grow_last = bytes;
+    a->memory_size += bytes;
+    __atomic_store_n(&a->regions, t, __ATOMIC_RELEASE);
+    __atomic_store_n(&a->region_hint, heap, __ATOMIC_RELEASE);
+    return true;
+} // map one more region big enough for size
+
+// one request against one child; each callback uses the part of (size, align, n) it needs
+typedef int (*region_try_fn)(allocator_t* heap, size_t size, size_t align, int n, void** out);
+
+static int region_try(allocator_t* a, allocator_t* heap, size_t size, size_t align, int n, void** out, region_try_fn try){
+    int got = try(heap, size, align, n, out);
+    if (got < n && !align) region_mark_full(a, heap, size);      // a memalign miss says nothing about plain requests
+    return got;
+}
+
+static int region_scan(allocator_t* a, const region_table_t* t, allocator_t* skip, size_t size, size_t align,
+                       int n, void** out, region_try_fn try){
+    int got = 0;
+    for (int i = 0; t && i < t->n && got < n; ++i) {
+        allocator_t* heap = t->r[i].heap;
+        if (heap == skip || region_full(a, heap, size)) continue;
+        int more = region_try(a, heap, size, align, n - got, out + got, try);
+        if (more) __atomic_store_n(&a->region_hint, heap, __ATOMIC_RELEASE);
+        got += more;
+    }
+    return got;
+} // every region but skip that may still serve size
+
+static int region_alloc(allocator_t* a, size_t size, size_t align, int n, void** out, region_try_fn try){
+    // the last region that worked first, then every other one, then new regions
+    if (size == 0 || size > REGION_MAX_REQUEST || n <= 0) return 0;
+    int got = 0;
+    allocator_t* hint = __atomic_load_n(&a->region_hint, __ATOMIC_ACQUIRE);
+    if (hint) got += region_try(a, hint, size, align, n - got, out + got, try);
+    if (got == n) return got;
+
+    const region_table_t* t = regions_of(a);
+    got += region_scan(a, t, hint, size, align, n - got, out + got, try);
+
+    bool shrunk = false;
+    while (got < n) {
+        if (!shrunk) {
+            // empty slabs and cached objects back to buddy first, then one more look at every region
+            shrunk = true;
+            region_shrink(a);
+            got += region_scan(a, t, NULL, size, align, n - got, out + got, try);
+            continue;
+        }
+        pthread_mutex_lock(&a->heap_lock);
+        uint64_t meta = region_meta_failures(a->regions);
+        bool ids = meta != a->grow_meta_seen;       // some region had the memory but no ids
+        bool grown = regions_of(a) != t || region_add(a, size + align, ids);   // somebody else may have grown it meanwhile
+        a->grow_meta_seen = meta;
+        t = regions_of(a);
+        allocator_t* fresh = __atomic_load_n(&a->region_hint, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&a->heap_lock);
+        if (!grown) break;
+        got += region_try(a, fresh, size, align, n - got, out + got, try);
+    }
+    return got;
+}
+
+static int try_malloc(allocator_t* heap, size_t size, size_t align, int n, void** out){
+    (void)align;
+    (void)n;
+    return (*out = alloc_malloc(heap, size)) != NULL;
+}
+
+static int try_calloc(allocator_t* heap, size_t size, size_t align, int n, void** out){
+    (void)align;
+    (void)n;
+    return (*out = alloc_calloc(heap, 1, size)) != NULL;
+}
+
+static int try_memalign(allocator_t* heap, size_t size, size_t align, int n, void** out){
+    (void)n;
+    return (*out = alloc_memalign(heap, align, size)) != NULL;
+}
+
+static int try_batch(allocator_t* heap, size_t size, size_t align, int n, void** out){
+    (void)align;
+    return alloc_malloc_batch(heap, size, n, out);
+}
+
+void* region_malloc(allocator_t* a, size_t size){
+    void* p = NULL;
+    region_alloc(a, size, 0, 1, &p, try_malloc);
+    return p;
+}
+
+void* region_calloc(allocator_t* a, size_t size){
+    void* p = NULL;
+    region_alloc(a, size, 0, 1, &p, try_calloc);
+    return p;
+}
+
+void* region_memalign(allocator_t* a, size_t alignment, size_t size){
+    if (alignment == 0 || (alignment & (alignment - 1)) || alignment > REGION_MAX_REQUEST) return NULL;
+    void* p = NULL;
+    region_alloc(a, size, alignment, 1, &p, try_memalign);
+    return p;
+}
+
+int region_malloc_batch(allocator_t* a, size_t size, int n, void** out){
+    return region_alloc(a, size, 0, n, out, try_batch);
+}
+
+void region_free(allocator_t* a, void* ptr){
+    allocator_t* heap = region_of_ptr(a, ptr);
+    if (!heap) return;
+    alloc_free(heap, ptr);
+    region_mark_freed(heap);
+}
+
+void region_free_sized(allocator_t* a, void* ptr, size_t size){
+    allocator_t* heap = region_of_ptr(a, ptr);
+    if (!heap) return;
+    alloc_free_sized(heap, ptr, size);
+    region_mark_freed(heap);
+}
+
+void* region_realloc(allocator_t* a, void* ptr, size_t size){
+    // in place or inside its own region first, otherwise move it to another region
+    allocator_t* heap = region_of_ptr(a, ptr);
+    if (!heap) return NULL;
+    size_t old = profile_sampled(heap, ptr) ? profile_usable_size(heap, ptr)
+               : a->mode_type == MALLOC_BUDDY ? buddy_usable_size(heap, ptr) : slab_usable_size(heap, ptr);
+    void* p = alloc_realloc(heap, ptr, size);
+    if (p || size == 0) {
+        if (size <= old) region_mark_freed(heap);       // shrunk in place or freed
+        return p;
+    }
+    p = region_malloc(a, size);
+    if (!p) return NULL;
+    memcpy(p, ptr, old < size ? old : size);
+    alloc_free(heap, ptr);
+    region_mark_freed(heap);
+    return p;
+}
+
+void region_reset(allocator_t* a){
+    const region_table_t* t = regions_of(a);
+    for (int i = 0; t && i < t->n; ++i) {
+        alloc_reset(t->r[i].heap);
+        region_mark_freed(t->r[i].heap);
+    }
+}
+
+size_t region_trim(allocator_t* a){
+    const region_table_t* t = regions_of(a);
+    size_t purged = 0;
+    for (int i = 0; t && i < t->n; ++i) purged += alloc_trim(t->r[i].heap);
+    return purged;
+}
+
+size_t region_shrink(allocator_t* a){
+    const region_table_t* t = regions_of(a);
+    size_t released = 0;
+    for (int i = 0; t && i < t->n; ++i) {
+        released += alloc_shrink(t->r[i].heap);
+        region_mark_freed(t->r[i].heap);        // cached objects may have gone back too
+    }
+    return released;
+}
+
+void region_init(allocator_t* a, const alloc_config_t* config){
+    a->grow_config = *config;
+    if (config->type == MALLOC_HYBRID && config->slab_max_size == 0)     // one threshold for every region
+        a->grow_config.slab_max_size = slab_default_max_size(config->memory_size, a->header_size, config->n_objs_per_slab);
+    a->slab_max_size = a->grow_config.slab_max_size;
+    a->max_memory_size = config->max_memory_size;
+    a->memory_size = 0;
+    a->grow_meta_seen = 0;
+    a->regions = NULL;
+    a->region_hint = NULL;
+    pthread_mutex_init(&a->heap_lock, NULL);
+    pthread_mutex_lock(&a->heap_lock);
+    region_add(a, 1, false);                   // the initial region, memory_size big (or bigger)
+    pthread_mutex_unlock(&a->heap_lock);
+}
+
+void region_cleanup(allocator_t* a){
+    region_table_t* t = a->regions;
+    for (int i = 0; t && i < t->n; ++i) {
+        alloc_destroy(t->r[i].heap);
+        munmap((void*)t->r[i].start, t->r[i].end - t->r[i].start);
+    }
+    while (t) {
+        region_table_t* older = t->retired;
+        free(t);
+        t = older;
+    }
+    a->regions = NULL;
+    a->region_hint = NULL;
+    pthread_mutex_destroy(&a->heap_lock);
+}
@@ -0,0 +1,151 @@
+#include "api.h"
+#include "my_memory.h"
+
+// Statistics snapshot
+// Free blocks come from the per-order free counts, slab numbers from walking the live slabs,
+// the rest are the counters the hot paths bump (alloc_counters_t).
+
+static void buddy_stats(allocator_t* a, malloc_stats_t* out){
+    out->memory_size = a->memory_size;
+    out->min_chunk_size = a->min_chunk_size;
+    out->max_order = a->max_order;
+    for (int order = 0; order <= a->max_order && order < MALLOC_STATS_ORDERS; ++order) {
+        size_t blk = a->min_chunk_size << order;
+        out->free_blocks[order] = a->free_counts[order];
+        out->free_bytes += a->free_counts[order] * blk;
+        if (a->free_counts[order]) out->largest_free = blk;
+        size_t words = ((a->nchunks - 1) >> order) / 64 + 1;
+        for (size_t w = 0; a->summary_words[order] && w < words; ++w)
+            out->clean_bytes += (size_t)__builtin_popcountll(a->free_bits[order][w] & a->clean_bits[order][w]) * blk;
+    }
+}
+
+static void slab_stats(allocator_t* a, malloc_stats_t* out){
+    out->n_caches = a->cache_count;
+    if (a->mode_type == MALLOC_HYBRID) out->slab_max_size = a->slab_max_size;
+    for (int c = 0; c < a->cache_count && c < MALLOC_STATS_CACHES; ++c)
+        out->caches[c].object_size = a->caches[c].type_bytes;
+
+    for (int i = 0; i < a->slab_count; ++i) {
+        sdt* S = &a->slabs[i];
+        if (!S->alive) continue;
+        size_t in_objs = (size_t)S->objs_in_slab * S->type_bytes;
+        out->slabs++;
+        if (S->used == 0) out->slabs_empty++;
+        out->slab_bytes += S->slab_size;
+        out->slab_slack += S->slab_size - in_objs;
+        out->slab_idle += (size_t)(S->objs_in_slab - S->used) * S->type_bytes;
+        if (S->cache < MALLOC_STATS_CACHES) {
+            malloc_cache_stats_t* cs = &out->caches[S->cache];
+            cs->slabs++;
+            cs->objects_used += S->used;
+            cs->objects_total += S->objs_in_slab;
+        }
+    }
+}
+
+static void merge_stats(malloc_stats_t* out, const malloc_stats_t* r){
+    // add one region's snapshot into the growable heap's one
+    out->memory_size += r->memory_size;
+    out->min_chunk_size = r->min_chunk_size;
+    if (r->max_order > out->max_order) out->max_order = r->max_order;
+    for (int o = 0; o < MALLOC_STATS_ORDERS; ++o) out->free_blocks[o] += r->free_blocks[o];
+    out->free_bytes += r->free_bytes;
+    if (r->largest_free > out->largest_free) out->largest_free = r->largest_free;
+
+    for (int c = 0; c < r->n_caches && c < MALLOC_STATS_CACHES; ++c) {
+        const malloc_cache_stats_t* rc = &r->caches[c];
+        int k = 0;
+        while (k < out->n_caches && out->caches[k].object_size != rc->object_size) k++;
+        if (k == MALLOC_STATS_CACHES) continue;
+        if (k == out->n_caches) out->caches[out->n_caches++].object_size = rc->object_size;
+        out->caches[k].slabs += rc->slabs;
+        out->caches[k].objects_used += rc->objects_used;
+        out->caches[k].objects_total += rc->objects_total;
+    }
+    out->slabs += r->slabs;
+    out->slabs_empty += r->slabs_empty;
+    out->slab_max_size = r->slab_max_size;
+    out->slab_bytes += r->slab_bytes;
+    out->slab_slack += r->slab_slack;
+    out->slab_idle += r->slab_idle;
+
+    out->splits += r->splits;
+    out->merges += r->merges;
+    out->buddy_allocs += r->buddy_allocs;
+    out->buddy_frees += r->buddy_frees;
+    out->buddy_failures += r->buddy_failures;
+    out->slab_allocs += r->slab_allocs;
+    out->slab_frees += r->slab_frees;
+    out->slab_failures += r->slab_failures;
+    out->slab_meta_failures += r->slab_meta_failures;
+    out->slabs_created += r->slabs_created;
+    out->slabs_destroyed += r->slabs_destroyed;
+    out->requested_bytes += r->requested_bytes;
+    out->granted_bytes += r->granted_bytes;
+    out->header_bytes += r->header_bytes;
+    out->clean_bytes += r->clean_bytes;
+    out->purges += r->purges;
+    out->purged_bytes += r->purged_bytes;
+}
+
+static void region_stats(allocator_t* a, malloc_stats_t* out){
+    const region_table_t* t = __atomic_load_n(&a->regions, __ATOMIC_ACQUIRE);
+    malloc_stats_t one;
+    for (int i = 0; t && i < t->n; ++i) {
+        alloc_stats(t->r[i].heap, &one);
+        merge_stats(out, &one);
+    }
+    out->regions = t ? t->n : 0;
+} // caches are matched up by object size, a failure counts once per region that failed
+
+void alloc_stats(allocator_t* a, malloc_stats_t* out){
+    memset(out, 0, sizeof(*out));
+    if (a->growable) {
+        region_stats(a, out);
+        return;
+    }
+    out->regions = 1;
+    if (a->thread_safe) pthread_mutex_lock(&a->heap_lock);
+
+    buddy_stats(a, out);
+    if (a->mode_type != MALLOC_BUDDY) slab_stats(a, out);
+
+    const alloc_counters_t* c = &a->stats;
+    out->splits = c->splits;
+    out->merges = c->merges;
+    out->buddy_allocs = c->buddy_allocs;
+    out->buddy_frees = c->buddy_frees;
+    out->buddy_failures = c->buddy_failures;
+    out->slab_allocs = c->slab_allocs;
+    out->slab_frees = c->slab_frees;
+    out->slab_failures = c->slab_failures;
+    out->slab_meta_failures = c->slab_meta_failures;
+    out->slabs_created = c->slabs_created;
+    out->slabs_destroyed = c->slabs_destroyed;
+    out->requested_bytes = c->requested_bytes;
+    out->granted_bytes = c->granted_bytes;
+    out->header_bytes = c->header_bytes;
+    out->purges = c->purges;
+    out->purged_bytes = c->purged_bytes;
+
+    if (a->thread_safe) pthread_mutex_unlock(&a->heap_lock);
+}
+
+size_t alloc_footprint(allocator_t* a){
+    if (a->growable) {
+        const region_table_t* t = __atomic_load_n(&a->regions, __ATOMIC_ACQUIRE);
+        size_t used = 0;
+        for (int i = 0; t && i < t->n; ++i) used += alloc_footprint(t->r[i].heap);
+        return used;
+    }
+    if (a->thread_safe) pthread_mutex_lock(&a->heap_lock);
+    size_t used = a->memory_size;
+    for (int order = 0; order <= a->max_order; ++order) used -= a->free_counts[order] * (a->min_chunk_size << order);
+    if (a->thread_safe) pthread_mutex_unlock(&a->heap_lock);
+    return used;
+} // memory_size - free_bytes of a snapshot, from the free counts alone
+
+void my_stats(malloc_stats_t* out){
+    alloc_stats(default_allocator, out);
+}
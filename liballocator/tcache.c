@@ -0,0 +1,349 @@
+#include "my_memory.h"
+
+// Thread safe mode (MALLOC_F_THREADSAFE)
+// Every thread owns two magazines per size class (Bonwick style "loaded" and "previous").
+// Frees and mallocs are served from them without any lock. When both are empty/full the
+// thread trades a whole magazine with the shared depot of that class, which has its own lock.
+// When the depot is full too, the freeing thread pushes the whole magazine onto the remote list
+// of the class with one CAS instead of taking the heap lock, and the next thread that finds
+// its magazines and the depot empty takes the list over with one exchange. Producer/consumer
+// pipelines, where every free is a cross-thread free, so never touch the heap lock.
+// Only when neither can help we take the heap lock and go to buddy/slab.
+// A magazine of a class holds at most 1/TCACHE_HEAP_SHARE of the heap (classes that do not fit
+// once skip the cache), the depot four magazines and the remote list TCACHE_REMOTE_CAP /
+// TCACHE_MAG_SIZE of them. When the heap still comes up empty, the caller's magazines, every
+// depot and every remote list go back to buddy/slab, so parked blocks can merge, and the
+// request is tried once more. Magazines of other threads stay theirs until they exit.
+
+#ifndef TCACHE_MAX_BYTES
+#define TCACHE_MAX_BYTES (32 * 1024)      // bigger buddy blocks are not worth holding per thread
+#endif
+#ifndef TCACHE_HEAP_SHARE
+#define TCACHE_HEAP_SHARE 1024            // a magazine holds at most memory_size / TCACHE_HEAP_SHARE bytes
+#endif
+
+typedef struct magazine {
+    int   count;
+    void* objs[TCACHE_MAG_SIZE];
+} magazine_t;
+
+typedef struct tcache {
+    allocator_t*    owner;                    // the thread exit destructor needs it
+    int64_t         sample_left;              // this thread's countdown to the next sampled malloc
+    int             loaded[TCACHE_CLASSES];   // which of the two magazines is the loaded one
+    magazine_t      mags[TCACHE_CLASSES][2];
+    struct tcache*  next;                     // all thread caches, so cleanup can find them
+    struct tcache*  prev;
+} tcache_t;
+
+static inline void* class_malloc(allocator_t* a, int cls){
+    // magazine refill, the real request size is not known here
+    if (a->mode_type == MALLOC_BUDDY) return buddy_malloc_class(a, cls, buddy_class_size(a, cls) - a->header_size);
+    return slab_malloc_class(a, cls, a->caches[cls].type_bytes - a->header_size);
+}
+
+static inline void class_free(allocator_t* a, void* user_ptr){
+    if (a->mode_type == MALLOC_BUDDY) buddy_free(a, user_ptr);
+    else slab_free(a, user_ptr);
+}
+
+static inline size_t class_bytes(allocator_t* a, int cls){
+    return a->mode_type == MALLOC_BUDDY ? buddy_class_size(a, cls) : a->caches[cls].type_bytes;
+}
+
+static inline bool class_holds_link(allocator_t* a, int cls){
+    return class_bytes(a, cls) - a->header_size >= sizeof(void*);
+} // objects of the class have room for the remote list link
+
+static int class_cap(allocator_t* a, int cls){
+    // worked out on first use, slab caches are made on demand; a race writes the same value
+    depot_t* d = &a->depots[cls];
+    int cap = __atomic_load_n(&d->mag_cap, __ATOMIC_RELAXED);
+    if (cap) return cap > 0 ? cap : 0;
+    size_t fit = a->memory_size / TCACHE_HEAP_SHARE / class_bytes(a, cls);
+    cap = fit == 0 ? -1 : fit < TCACHE_MAG_SIZE ? (int)fit : TCACHE_MAG_SIZE;
+    __atomic_store_n(&d->mag_cap, cap, __ATOMIC_RELAXED);
+    return cap > 0 ? cap : 0;
+} // objects per magazine of the class, 0 when one object is too big a share of the heap
+
+static inline void* obj_link(void* obj){
+    void* next;
+    memcpy(&next, obj, sizeof(next));            // slab objects are not aligned
+    return next;
+}
+
+static inline void obj_set_link(void* obj, void* next){
+    memcpy(obj, &next, sizeof(next));
+}
+
+static void remote_push(depot_t* d, void* first, void* last, int n){
+    // chain first..last is already linked, only the head needs a CAS; pops take the whole
+    // list at once, so a node can not come back while we look at the head (no ABA)
+    void* head = __atomic_load_n(&d->remote, __ATOMIC_RELAXED);
+    do {
+        obj_set_link(last, head);
+    } while (!__atomic_compare_exchange_n(&d->remote, &head, first, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&d->remote_count, n, __ATOMIC_RELAXED);
+}
+
+static bool remote_free(allocator_t* a, int cls, magazine_t* m, int cap){
+    depot_t* d = &a->depots[cls];
+    if (__atomic_load_n(&d->remote_count, __ATOMIC_RELAXED) >= TCACHE_REMOTE_CAP / TCACHE_MAG_SIZE * cap
+        || !class_holds_link(a, cls))
+        return false;
+    for (int i = 0; i + 1 < m->count; ++i) obj_set_link(m->objs[i], m->objs[i + 1]);
+    remote_push(d, m->objs[0], m->objs[m->count - 1], m->count);
+    m->count = 0;
+    return true;
+} // park a full magazine on the remote list, false when the heap has to take it
+
+static void remote_refill(depot_t* d, magazine_t* m, int cap){
+    // take the list over, keep a magazine full and put the rest back
+    void* obj = __atomic_exchange_n(&d->remote, NULL, __ATOMIC_ACQUIRE);
+    while (obj && m->count < cap) {
+        m->objs[m->count++] = obj;
+        obj = obj_link(obj);
+    }
+    __atomic_sub_fetch(&d->remote_count, m->count, __ATOMIC_RELAXED);
+    if (!obj) return;
+    void* last = obj;
+    int n = 1;
+    for (void* next; (next = obj_link(last)) != NULL; last = next) n++;
+    __atomic_sub_fetch(&d->remote_count, n, __ATOMIC_RELAXED);
+    remote_push(d, obj, last, n);
+}
+
+static void magazine_flush(allocator_t* a, magazine_t* m){
+    // caller holds the heap lock
+    while (m->count > 0) class_free(a, m->objs[--m->count]);
+}
+
+static void cache_flush(allocator_t* a, tcache_t* tc){
+    // caller holds the heap lock; tc may be NULL
+    for (int c = 0; c < TCACHE_CLASSES; ++c) {
+        if (tc) {
+            magazine_flush(a, &tc->mags[c][0]);
+            magazine_flush(a, &tc->mags[c][1]);
+        }
+        depot_t* d = &a->depots[c];
+        pthread_mutex_lock(&d->lock);
+        while (d->count > 0) class_free(a, d->objs[--d->count]);
+        pthread_mutex_unlock(&d->lock);
+        void* obj = __atomic_exchange_n(&d->remote, NULL, __ATOMIC_ACQUIRE);
+        int n = 0;
+        for (void* next; obj; obj = next, n++) {
+            next = obj_link(obj);
+            class_free(a, obj);
+        }
+        __atomic_sub_fetch(&d->remote_count, n, __ATOMIC_RELAXED);
+    }
+} // hand tc's magazines, the depots and the remote lists back to buddy/slab
+
+static void tcache_unlink(allocator_t* a, tcache_t* tc){
+    if (tc->prev) tc->prev->next = tc->next;
+    else a->tcache_all = tc->next;
+    if (tc->next) tc->next->prev = tc->prev;
+}
+
+static void tcache_destroy(void* arg){
+    // thread exit: hand every cached object back to the heap
+    tcache_t* tc = (tcache_t*)arg;
+    allocator_t* a = tc->owner;
+    pthread_mutex_lock(&a->heap_lock);
+    for (int c = 0; c < TCACHE_CLASSES; ++c) {
+        magazine_flush(a, &tc->mags[c][0]);
+        magazine_flush(a, &tc->mags[c][1]);
+    }
+    tcache_unlink(a, tc);
+    pthread_mutex_unlock(&a->heap_lock);
+    free(tc);
+}
+
+static tcache_t* tcache_get(allocator_t* a){
+    tcache_t* tc = (tcache_t*)pthread_getspecific(a->tcache_key);
+    if (tc) return tc;
+    tc = (tcache_t*)calloc(1, sizeof(tcache_t));
+    if (!tc) return NULL;
+    tc->owner = a;
+    tc->sample_left = profile_next_gap(a);
+    pthread_mutex_lock(&a->heap_lock);
+    tc->next = a->tcache_all;
+    if (a->tcache_all) a->tcache_all->prev = tc;
+    a->tcache_all = tc;
+    pthread_mutex_unlock(&a->heap_lock);
+    pthread_setspecific(a->tcache_key, tc);
+    return tc;
+} // the calling thread's cache, made on first use
+
+static int size_class(allocator_t* a, size_t user_size){
+    if (a->mode_type == MALLOC_BUDDY) {
+        int order = buddy_size_class(a, user_size);
+        if (order < 0 || order >= TCACHE_CLASSES || buddy_class_size(a, order) > TCACHE_MAX_BYTES) return -1;
+        return class_cap(a, order) ? order : -1;
+    }
+    int cid = slab_size_class(a, user_size, false);      // lock free lookup first
+    if (cid < 0) {
+        pthread_mutex_lock(&a->heap_lock);
+        cid = slab_size_class(a, user_size, true);
+        pthread_mutex_unlock(&a->heap_lock);
+    }
+    return cid >= 0 && cid < TCACHE_CLASSES && class_cap(a, cid) ? cid : -1;
+} // size class served by the thread cache, -1 to go straight to the heap
+
+static int class_of_ptr(allocator_t* a, void* user_ptr){
+    int cls = a->mode_type == MALLOC_BUDDY ? buddy_class_of_ptr(a, user_ptr) : slab_class_of_ptr(a, user_ptr);
+    if (cls < 0 || cls >= TCACHE_CLASSES) return -1;
+    if (a->mode_type == MALLOC_BUDDY && buddy_class_size(a, cls) > TCACHE_MAX_BYTES) return -1;
+    return class_cap(a, cls) ? cls : -1;
+}
+
+static void* locked_malloc(allocator_t* a, tcache_t* tc, size_t size){
+    pthread_mutex_lock(&a->heap_lock);
+    void* p = a->mode_type == MALLOC_BUDDY ? buddy_malloc(a, size) : slab_malloc(a, size);
+    if (!p) {                                  // cached blocks may be what it is missing
+        cache_flush(a, tc);
+        p = a->mode_type == MALLOC_BUDDY ? buddy_malloc(a, size) : slab_malloc(a, size);
+    }
+    pthread_mutex_unlock(&a->heap_lock);
+    return p;
+}
+
+static void locked_free(allocator_t* a, void* user_ptr){
+    pthread_mutex_lock(&a->heap_lock);
+    class_free(a, user_ptr);
+    pthread_mutex_unlock(&a->heap_lock);
+}
+
+static void* tcache_take(allocator_t* a, tcache_t* tc, size_t size){
+    int cls = size_class(a, size);
+    if (cls < 0 || !tc) return locked_malloc(a, tc, size);
+    int cap = class_cap(a, cls);
+
+    magazine_t* m = &tc->mags[cls][tc->loaded[cls]];
+    if (m->count > 0) return m->objs[--m->count];
+
+    magazine_t* prev = &tc->mags[cls][!tc->loaded[cls]];
+    if (prev->count > 0) {                         // previous one still has objects, swap
+        tc->loaded[cls] = !tc->loaded[cls];
+        return prev->objs[--prev->count];
+    }
+
+    depot_t* d = &a->depots[cls];                     // refill a whole magazine from the depot
+    pthread_mutex_lock(&d->lock);
+    int n = d->count < cap ? d->count : cap;
+    d->count -= n;
+    memcpy(m->objs, &d->objs[d->count], (size_t)n * sizeof(void*));
+    pthread_mutex_unlock(&d->lock);
+    m->count = n;
+    if (m->count > 0) return m->objs[--m->count];
+
+    if (__atomic_load_n(&d->remote, __ATOMIC_RELAXED)) remote_refill(d, m, cap);   // frees of other threads
+    if (m->count > 0) return m->objs[--m->count];
+
+    pthread_mutex_lock(&a->heap_lock);         // slow path, half a magazine under one lock
+    while (m->count < (cap + 1) / 2) {
+        void* p = class_malloc(a, cls);
+        if (!p && m->count == 0) {
+            cache_flush(a, tc);
+            p = class_malloc(a, cls);
+        }
+        if (!p) break;
+        m->objs[m->count++] = p;
+    }
+    pthread_mutex_unlock(&a->heap_lock);
+    return m->count > 0 ? m->objs[--m->count] : NULL;
+}
+
+void* tcache_malloc(allocator_t* a, size_t size){
+    if (size == 0) return NULL;
+    tcache_t* tc = tcache_get(a);
+    if (tc && (tc->sample_left -= (int64_t)size) < 0) return profile_malloc(a, &tc->sample_left, size);
+    return tcache_take(a, tc, size);
+}
+
+void* tcache_malloc_unsampled(allocator_t* a, size_t size){
+    if (size == 0) return NULL;
+    return tcache_take(a, tcache_get(a), size);
+}
+
+static void tcache_put(allocator_t* a, int cls, void* user_ptr){
+    tcache_t* tc = cls >= 0 ? tcache_get(a) : NULL;
+    if (!tc) {
+        locked_free(a, user_ptr);
+        return;
+    }
+
+    int cap = class_cap(a, cls);
+    magazine_t* m = &tc->mags[cls][tc->loaded[cls]];
+    if (m->count == cap) {
+        magazine_t* prev = &tc->mags[cls][!tc->loaded[cls]];
+        if (prev->count == 0) {                    // previous one is empty, swap
+            tc->loaded[cls] = !tc->loaded[cls];
+            m = prev;
+        } else {
+            depot_t* d = &a->depots[cls];             // park the full magazine in the depot
+            pthread_mutex_lock(&d->lock);
+            bool fits = d->count + cap <= DEPOT_CAP / TCACHE_MAG_SIZE * cap;
+            if (fits) {
+                memcpy(&d->objs[d->count], m->objs, (size_t)cap * sizeof(void*));
+                d->count += cap;
+            }
+            pthread_mutex_unlock(&d->lock);
+            if (fits) {
+                m->count = 0;
+            } else if (!remote_free(a, cls, m, cap)) {
+                pthread_mutex_lock(&a->heap_lock);   // remote list is full too, give it back to the heap
+                magazine_flush(a, m);
+                pthread_mutex_unlock(&a->heap_lock);
+            }
+        }
+    }
+    m->objs[m->count++] = user_ptr;
+}
+
+void tcache_free(allocator_t* a, void* user_ptr){
+    tcache_put(a, class_of_ptr(a, user_ptr), user_ptr);
+}
+
+void tcache_free_sized(allocator_t* a, void* user_ptr, size_t size){
+    // buddy classes follow from the size; a slab object names its cache in the header anyway,
+    // which is cheaper than the size lookup
+    int cls = a->mode_type == MALLOC_BUDDY ? size_class(a, size) : class_of_ptr(a, user_ptr);
+    tcache_put(a, cls, user_ptr);
+}
+
+void tcache_flush(allocator_t* a){
+    pthread_mutex_lock(&a->heap_lock);
+    cache_flush(a, (tcache_t*)pthread_getspecific(a->tcache_key));
+    pthread_mutex_unlock(&a->heap_lock);
+}
+
+void tcache_init(allocator_t* a){
+    for (int c = 0; c < TCACHE_CLASSES; ++c) {
+        pthread_mutex_init(&a->depots[c].lock, NULL);
+        a->depots[c].count = 0;
+        a->depots[c].mag_cap = 0;
+        a->depots[c].remote = NULL;
+        a->depots[c].remote_count = 0;
+    }
+    a->tcache_all = NULL;
+    pthread_mutex_init(&a->heap_lock, NULL);
+    pthread_key_create(&a->tcache_key, tcache_destroy);
+}
+
+void tcache_cleanup(allocator_t* a){
+    // no other thread may use the allocator any more; the heap is about to be dropped,
+    // so cached objects are simply forgotten
+    pthread_key_delete(a->tcache_key);
+    while (a->tcache_all) {
+        tcache_t* tc = a->tcache_all;
+        a->tcache_all = tc->next;
+        free(tc);
+    }
+    for (int c = 0; c < TCACHE_CLASSES; ++c) {
+        pthread_mutex_destroy(&a->depots[c].lock);
+        a->depots[c].count = 0;
+        a->depots[c].remote = NULL;
+        a->depots[c].remote_count = 0;
+    }
+}
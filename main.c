@@ -9,62 +9,95 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <time.h>
 
 #include "api.h"
+#include "trace.h"
 
 #define MAX_LINE_LEN 1024
-#define MAX_LOG_SIZE 1024 * 1024 * 128
+#define LOG_BUF_SIZE 64 * 1024
 
 struct handle {
     char name;           // name
     void **addresses;    // list of addresses returned from my_malloc()
+    int num_addresses;   // addresses[1..num_addresses] are valid indexes
+    int num_requested;   // objects the 'M' line asked for, the ones past num_addresses failed
     int num_allocs;      // number of allocations
     struct handle *next; // pointer to next entry
 };
 typedef struct handle handle_t;
 
-struct ops {
-    char name;  // name
-    int numops; // number of allocation requests OR index
-    char type;  // 'M' OR 'F'
-    int size;   // size of allocation request
+// All handles in trace order, plus the handle every name's 'F' requests go to: the first one,
+// or a later one once everything of the earlier handle is freed (lets traces reuse names)
+struct handles {
+    handle_t *head;
+    handle_t *tail;
+    handle_t *by_name[256];
+    bool any_chunk;      // some 'M' line got memory, later chunks are not the first one
 };
-typedef struct ops ops_t;
+typedef struct handles handles_t;
 
-bool read_next_op(FILE *fd, ops_t *op);
-void call_my_malloc(char *output_log, handle_t **handles, ops_t *op, void *RAM);
-void call_my_free(char *output_log, handle_t *handles, ops_t *op, void *RAM);
+// Output log, buffered and written out in chunks as the trace replays
+struct log {
+    FILE *file;    // NULL when logging is off (--no-log)
+    char *buf;
+    size_t len;    // write position in buf
+};
+typedef struct log log_t;
+
+void call_my_malloc(log_t *log, handles_t *handles, ops_t *op, void *RAM);
+void call_my_free(log_t *log, handles_t *handles, ops_t *op, void *RAM);
+void log_printf(log_t *log, const char *fmt, ...);
+void log_flush(log_t *log);
+void print_stats(FILE *out);
 
 // Main function
 // Read input file and call functions accordingly
 int main(int argc, char *argv[]) {
     printf("%s: Hello Allocator Project!\n", __func__);
     if (argc < 3) {
-        fprintf(stderr, "Not enough parameters specified.  Usage: %s <allocation_type> <input_file>\n", argv[0]);
+        fprintf(stderr, "Not enough parameters specified.  Usage: %s <allocation_type> <input_file> [--stats] [--no-log]\n", argv[0]);
         fprintf(stderr, "  Allocation type: 0 - Buddy Allocator\n");
         fprintf(stderr, "  Allocation type: 1 - Slab Allocator\n");
+        fprintf(stderr, "  Allocation type: 2 - Hybrid (slab for small requests, buddy for large ones)\n");
+        fprintf(stderr, "  --stats: print allocator statistics after the trace\n");
+        fprintf(stderr, "  --no-log: write no output file, only time the replay\n");
         exit(EXIT_FAILURE);
     }
 
+    // Optional flags after the input file
+    bool dump_stats = false;
+    bool no_log = false;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            dump_stats = true;
+        } else if (strcmp(argv[i], "--no-log") == 0) {
+            no_log = true;
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Verify allocator type
     int type = atoi(argv[1]);
-    if (type != MALLOC_BUDDY && type != MALLOC_SLAB) {
+    if (type != MALLOC_BUDDY && type != MALLOC_SLAB && type != MALLOC_HYBRID) {
         fprintf(stderr, "Invalid option\n");
         exit(EXIT_FAILURE);
     }
 
-    // Open input file
-    FILE *input_file = fopen(argv[2], "r");
-    if (input_file == NULL) {
+    // Open input file (text or binary trace)
+    trace_t input_trace;
+    if (!trace_open(&input_trace, argv[2])) {
         perror("fopen() error");
         exit(EXIT_FAILURE);
     }
 
     // Allocator configuration
-    int MEMORY_SIZE = 8 * 1024 * 1024;
-    int HEADER_SIZE = 8;
-    int MIN_MEM_CHUNK_SIZE = 512;
-    int N_OBJS_PER_SLAB = 64;
+    int MEMORY_SIZE = TRACE_MEMORY_SIZE;
+    int HEADER_SIZE = TRACE_HEADER_SIZE;
+    int MIN_MEM_CHUNK_SIZE = TRACE_MIN_MEM_CHUNK_SIZE;
+    int N_OBJS_PER_SLAB = TRACE_N_OBJS_PER_SLAB;
     printf("%s: MEMORY_SIZE: %d, HEADER_SIZE: %d, MIN_MEM_CHUNK_SIZE: %d, N_OBJS_PER_SLAB: %d\n",
            __func__, MEMORY_SIZE, HEADER_SIZE, MIN_MEM_CHUNK_SIZE, N_OBJS_PER_SLAB);
 
@@ -75,132 +108,85 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    // Allocate memory for logging
-    char *output_log = (char *)malloc(MAX_LOG_SIZE);
-    if (output_log == NULL) {
-        perror("malloc() error");
-        exit(EXIT_FAILURE);
+    // Open output file and allocate the log buffer
+    char output_filename[512] = {0};
+    log_t log = {0};
+    if (!no_log) {
+        mkdir("output", 0755);
+        strcat(output_filename, "output/result-");
+        strcat(output_filename, argv[1]);
+        strcat(output_filename, "-");
+        strcat(output_filename, basename(argv[2]));
+        log.file = fopen(output_filename, "w");
+        if (log.file == NULL) {
+            perror("fopen() error");
+            exit(EXIT_FAILURE);
+        }
+        log.buf = (char *)malloc(LOG_BUF_SIZE);
+        if (log.buf == NULL) {
+            perror("malloc() error");
+            exit(EXIT_FAILURE);
+        }
     }
-    memset(output_log, 0, MAX_LOG_SIZE);
 
     // List of handles (save the return addresses from my_malloc())
-    handle_t *handles = NULL;
+    handles_t handles = {0};
 
     my_setup(type, MEMORY_SIZE, RAM, HEADER_SIZE, MIN_MEM_CHUNK_SIZE, N_OBJS_PER_SLAB);
 
     // Read operation and call interface function
     ops_t *op = (ops_t *)malloc(sizeof(ops_t));
-    while (read_next_op(input_file, op)) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (trace_next(&input_trace, op)) {
         if (op->type == 'M') {
-            call_my_malloc(output_log, &handles, op, RAM);
+            call_my_malloc(&log, &handles, op, RAM);
         } else if (op->type == 'F') {
-            call_my_free(output_log, handles, op, RAM);
+            call_my_free(&log, &handles, op, RAM);
         } else {
-            // Should not reach here... validation done in read_next_op()
+            // Should not reach here... validation done in trace_next()
             fprintf(stderr, "Incorrect operation type in input file\n");
             exit(EXIT_FAILURE);
         }
     }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (dump_stats) {
+        print_stats(stdout);
+    }
 
     my_cleanup();
 
-    fclose(input_file);
+    trace_close(&input_trace);
 
     // Free remaining handles
-    while (handles != NULL) {
-        handle_t *free_next = handles;
-        handles = handles->next;
+    while (handles.head != NULL) {
+        handle_t *free_next = handles.head;
+        handles.head = handles.head->next;
         free(free_next->addresses);
         free(free_next);
     }
 
-    // Open output file
-    char output_filename[512] = {0};
-    mkdir("output", 0755);
-    strcat(output_filename, "output/result-");
-    strcat(output_filename, argv[1]);
-    strcat(output_filename, "-");
-    strcat(output_filename, basename(argv[2]));
-    FILE *output_file = fopen(output_filename, "w");
-    if (output_file == NULL) {
-        perror("fopen() error");
-        exit(EXIT_FAILURE);
-    }
-
-    size_t ret = fwrite(output_log, sizeof(char), strlen(output_log), output_file);
-    if (ret != strlen(output_log)) {
-        fprintf(stderr, "fwrite() failed.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    fclose(output_file);
-    free(output_log);
     free(op);
     free(RAM);
 
-    printf("%s: Output file: %s\n", __func__, output_filename);
+    if (no_log) {
+        double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        printf("%s: Replay took %.3f ms\n", __func__, ms);
+    } else {
+        // Write out what is left in the log buffer
+        log_flush(&log);
+        fclose(log.file);
+        free(log.buf);
+        printf("%s: Output file: %s\n", __func__, output_filename);
+    }
     printf("%s: Bye!\n", __func__);
     return 0;
 }
 
-// Read and parse one line
-bool read_next_op(FILE *fd, ops_t *op) {
-    char line[MAX_LINE_LEN];
-    if (!fgets(line, MAX_LINE_LEN, fd))
-        return false;
-
-    char *token;
-    char delim[2] = " ";
-    char *rest = line;
-
-    token = strtok_r(rest, delim, &rest);
-    if (token)
-        op->name = *token;
-    else
-        goto err;
-
-    token = strtok_r(rest, delim, &rest);
-    if (token)
-        op->numops = atoi(token);
-    else
-        goto err;
-
-    token = strtok_r(rest, delim, &rest);
-    if (token)
-        op->type = *token;
-    else
-        goto err;
-
-    token = strtok_r(rest, delim, &rest);
-    if (token)
-        op->size = atoi(token);
-    // else
-    // 	goto err;
-
-    // Request (input file) validation
-    if (op->type != 'M' && op->type != 'F') {
-        fprintf(stderr, "%s: Invalid type in input file.\n", __func__);
-        exit(EXIT_FAILURE);
-    }
-    if (op->numops <= 0) {
-        fprintf(stderr, "%s: Invalid number in input file.\n", __func__);
-        exit(EXIT_FAILURE);
-    }
-    if (op->type == 'M' && op->size <= 0) {
-        fprintf(stderr, "%s: Invalid size in input file.\n", __func__);
-        exit(EXIT_FAILURE);
-    }
-
-    return true;
-
-err:
-    fprintf(stderr, "%s: Invalid line in input file.\n", __func__);
-    exit(EXIT_FAILURE);
-}
-
 // Save operation in list and call my_malloc() accordingly
-void call_my_malloc(char *output_log, handle_t **handles, ops_t *op, void *RAM) {
-    bool first = false;
+void call_my_malloc(log_t *log, handles_t *handles, ops_t *op, void *RAM) {
+    bool first = !handles->any_chunk;
 
     // Allocate an handle for this operation
     handle_t *new_entry;
@@ -208,78 +194,145 @@ void call_my_malloc(char *output_log, handle_t **handles, ops_t *op, void *RAM)
     new_entry->name = op->name;
     new_entry->num_allocs = 0;
     new_entry->addresses = (void **)malloc(sizeof(void *) * (op->numops + 1));
+    new_entry->num_addresses = 0;
+    new_entry->num_requested = op->numops;
     new_entry->next = NULL;
 
-    // Add to handles list
-    handle_t *temp = *handles;
-    if (temp == NULL) {
-        *handles = new_entry;
-        first = true;
-    } else {
-        while (temp->next != NULL) {
-            temp = temp->next;
-        }
-        temp->next = new_entry;
+    // Add to the tail of handles list, also when nothing gets allocated: 'F' lines may name
+    // the objects that failed
+    if (handles->tail == NULL)
+        handles->head = new_entry;
+    else
+        handles->tail->next = new_entry;
+    handles->tail = new_entry;
+
+    // For given NumOps, try to allocate memory in one batch
+    // (it stops at the first failure, like calling my_malloc() NumOps times)
+    int got = my_malloc_batch(op->size, op->numops, new_entry->addresses + 1);
+    new_entry->num_addresses = got;
+    for (int i = 1; i <= got; i++) {
+        // my_malloc() successful
+        new_entry->num_allocs += 1;
+
+        // Print to output_file
+        if (first)
+            log_printf(log, "Start of first Chunk %c is: %d\n", op->name, (int)((void *)(*(new_entry->addresses + i)) - RAM));
+        else
+            log_printf(log, "Start of Chunk %c is: %d\n", op->name, (int)((void *)(*(new_entry->addresses + i)) - RAM));
     }
+    if (got > 0)
+        handles->any_chunk = true;
 
-    // For given NumOps, try to allocate memory
-    for (int i = 1; i <= op->numops; i++) {
-        void *x = my_malloc(op->size);
-        if (x == NULL) {
-            // my_malloc() request failed
+    handle_t **named = &handles->by_name[(unsigned char)op->name];
+    if (*named == NULL || (*named)->num_allocs == 0)
+        *named = new_entry;
 
-            if (new_entry != NULL && new_entry->num_allocs == 0) {
-                free(new_entry->addresses);
-                free(new_entry);
+    if (got < op->numops) {
+        // Print the error to output_file
+        log_printf(log, "Allocation Error %c\n", op->name);
+    }
+}
 
-                if (temp)
-                    temp->next = NULL;
-                else
-                    *handles = NULL;
-            }
+// Look up the handle of the name and call my_free() accordingly
+void call_my_free(log_t *log, handles_t *handles, ops_t *op, void *RAM) {
+    handle_t *hp1 = handles->by_name[(unsigned char)op->name];
+    if (hp1 == NULL)
+        return;
+
+    // entry found in handle table
+    int index = op->numops;
+    if (index > hp1->num_addresses && index <= hp1->num_requested) {
+        // the batch failed before this object, there is nothing to free. An 'M' that got
+        // nothing never left a handle, so its 'F' lines always went by without a trace; past a
+        // partial batch it is logged, so it shows up against the expected output
+        if (hp1->num_addresses > 0)
+            log_printf(log, "Skipped free of object %c %d, its allocation failed\n", op->name, index);
+        return;
+    }
 
-            // Print the error to output_file
-            sprintf(output_log + strlen(output_log), "Allocation Error %c\n", op->name);
-            break;
-        } else {
-            // my_malloc() successful
+    void *ptr_to_free = index <= hp1->num_addresses ? *(hp1->addresses + index) : NULL;
+    if (ptr_to_free == NULL) {
+        fprintf(stderr, "%s: Invalid 'F' request in input file.\n", __func__);
+        exit(EXIT_FAILURE);
+    }
 
-            // Save the returned pointer
-            *(new_entry->addresses + i) = x;
-            new_entry->num_allocs += 1;
+    my_free(ptr_to_free);
 
-            // Print to output_file
-            if (first)
-                sprintf(output_log + strlen(output_log), "Start of first Chunk %c is: %d\n", op->name, (int)((void *)(*(new_entry->addresses + i)) - RAM));
-            else
-                sprintf(output_log + strlen(output_log), "Start of Chunk %c is: %d\n", op->name, (int)((void *)(*(new_entry->addresses + i)) - RAM));
-        }
-    }
+    // The ptr is now freed
+    *(hp1->addresses + index) = NULL;
+    hp1->num_allocs -= 1;
+
+    // Print to output_file
+    log_printf(log, "freed object %c at %d\n", op->name, (int)((void *)(ptr_to_free)-RAM));
 }
 
-// Search for corresponding name in list and call my_free() accordingly
-void call_my_free(char *output_log, handle_t *handles, ops_t *op, void *RAM) {
-    handle_t *hp1 = handles;
-    while (hp1 != NULL) {
-        if (hp1->name == op->name) {
-            // entry found in handle list
-            int index = op->numops;
-            void *ptr_to_free = *(hp1->addresses + index);
-            if (ptr_to_free == NULL) {
-                fprintf(stderr, "%s: Invalid 'F' request in input file.\n", __func__);
-                exit(EXIT_FAILURE);
-            }
+// Append one line to the log, flush the buffer to the output file when it runs full
+void log_printf(log_t *log, const char *fmt, ...) {
+    if (log->file == NULL)
+        return;
+    if (LOG_BUF_SIZE - log->len < MAX_LINE_LEN)
+        log_flush(log);
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(log->buf + log->len, LOG_BUF_SIZE - log->len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= LOG_BUF_SIZE - log->len) {
+        fprintf(stderr, "%s: log line too long.\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    log->len += n;
+}
 
-            my_free(ptr_to_free);
+// Write the buffered log to the output file
+void log_flush(log_t *log) {
+    if (log->file == NULL || log->len == 0)
+        return;
+    size_t ret = fwrite(log->buf, sizeof(char), log->len, log->file);
+    if (ret != log->len) {
+        fprintf(stderr, "fwrite() failed.\n");
+        exit(EXIT_FAILURE);
+    }
+    log->len = 0;
+}
 
-            // The ptr is now freed
-            *(hp1->addresses + index) = NULL;
-            hp1->num_allocs -= 1;
+// Print a my_stats() snapshot of the heap
+void print_stats(FILE *out) {
+    malloc_stats_t st;
+    my_stats(&st);
 
-            // Print to output_file
-            sprintf(output_log + strlen(output_log), "freed object %c at %d\n", op->name, (int)((void *)(ptr_to_free)-RAM));
-            break;
+    fprintf(out, "--- allocator stats ---\n");
+    fprintf(out, "buddy: memory %zu, min chunk %zu, max order %d\n", st.memory_size, st.min_chunk_size, st.max_order);
+    fprintf(out, "  free %zu bytes (%zu clean), largest free block %zu\n", st.free_bytes, st.clean_bytes, st.largest_free);
+    if (st.purges > 0) {
+        fprintf(out, "  purged %llu bytes in %llu passes\n", (unsigned long long)st.purged_bytes, (unsigned long long)st.purges);
+    }
+    for (int order = 0; order <= st.max_order && order < MALLOC_STATS_ORDERS; order++) {
+        if (st.free_blocks[order] > 0) {
+            fprintf(out, "  order %2d (%zu bytes): %zu free\n", order, st.min_chunk_size << order, st.free_blocks[order]);
         }
-        hp1 = hp1->next;
     }
+    fprintf(out, "  allocs %llu, frees %llu, failures %llu, splits %llu, merges %llu\n",
+            (unsigned long long)st.buddy_allocs, (unsigned long long)st.buddy_frees,
+            (unsigned long long)st.buddy_failures, (unsigned long long)st.splits, (unsigned long long)st.merges);
+
+    if (st.n_caches > 0) {
+        fprintf(out, "slab: %d caches, %d slabs, %zu bytes (slack %zu, idle %zu)\n",
+                st.n_caches, st.slabs, st.slab_bytes, st.slab_slack, st.slab_idle);
+        for (int c = 0; c < st.n_caches && c < MALLOC_STATS_CACHES; c++) {
+            malloc_cache_stats_t *cs = &st.caches[c];
+            if (cs->slabs > 0) {
+                fprintf(out, "  cache %3d (%zu bytes): %d slabs, %d/%d objects used\n",
+                        c, cs->object_size, cs->slabs, cs->objects_used, cs->objects_total);
+            }
+        }
+        fprintf(out, "  allocs %llu, frees %llu, failures %llu, out of ids %llu, slabs created %llu, destroyed %llu\n",
+                (unsigned long long)st.slab_allocs, (unsigned long long)st.slab_frees,
+                (unsigned long long)st.slab_failures, (unsigned long long)st.slab_meta_failures, (unsigned long long)st.slabs_created,
+                (unsigned long long)st.slabs_destroyed);
+    }
+
+    fprintf(out, "requests: %llu bytes asked, %llu granted, %llu in headers\n",
+            (unsigned long long)st.requested_bytes, (unsigned long long)st.granted_bytes,
+            (unsigned long long)st.header_bytes);
 }
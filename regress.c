@@ -0,0 +1,243 @@
+#include <sys/mman.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "api.h"
+
+// Regression checks
+// Each check builds its own heap through the instance API, runs the case a bug report came
+// with and prints PASS or FAIL. Big arenas are MAP_NORESERVE mappings, only the pages the
+// allocator touches are backed. Exits non-zero when any check fails.
+
+#define GB ((size_t)1 << 30)
+
+static int failures;
+
+static void report(const char *name, bool ok) {
+    printf("%-40s %s\n", name, ok ? "PASS" : "FAIL");
+    if (!ok)
+        failures++;
+}
+
+static void *map_arena(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static allocator_t *make_heap(enum malloc_type type, void *ram, size_t size, size_t min_chunk, unsigned flags) {
+    alloc_config_t config = {0};
+    config.type = type;
+    config.memory_size = size;
+    config.start_of_memory = ram;
+    config.header_size = 8;
+    config.min_mem_chunk_size = min_chunk;
+    config.n_objs_per_slab = 16;
+    config.flags = flags;
+    return alloc_create(&config);
+}
+
+static void check_threadsafe_over_4g(void) {
+    // a request above 4 GB has no thread cache class, the locked path must keep its size
+    const size_t arena = 8 * GB, size = ((size_t)1 << 32) + 100;
+    void *ram = map_arena(arena);
+    if (ram == NULL) {
+        printf("%-40s SKIP (no %zu GB mapping)\n", "threadsafe malloc over 4 GB", arena / GB);
+        return;
+    }
+    allocator_t *a = make_heap(MALLOC_BUDDY, ram, arena, 4096, MALLOC_F_THREADSAFE);
+    void *p = a ? alloc_malloc(a, size) : NULL;
+    malloc_stats_t st;
+    if (a)
+        alloc_stats(a, &st);
+    bool ok = p != NULL && (char *)p + size <= (char *)ram + arena && st.free_bytes + size <= arena;   // the whole 8 GB block
+    report("threadsafe malloc over 4 GB", ok);
+    if (a) {
+        alloc_free(a, p);
+        alloc_destroy(a);
+    }
+    munmap(ram, arena);
+}
+
+static void check_threadsafe_cached_blocks(void) {
+    // blocks parked in magazines, the depot and the remote list could not merge any more, so a
+    // big request failed on a thread safe heap that the plain heap served
+    const size_t arena = 16 << 20;
+    enum { N = 1024 };
+    static void *blocks[N];
+    void *ram = map_arena(arena);
+    allocator_t *a = ram ? make_heap(MALLOC_BUDDY, ram, arena, 64, MALLOC_F_THREADSAFE) : NULL;
+    bool ok = a != NULL;
+    for (int i = 0; ok && i < N; i++)
+        blocks[i] = alloc_malloc(a, 16000);
+    for (int i = 0; ok && i < N; i++)
+        alloc_free(a, blocks[i]);
+    void *p = ok ? alloc_malloc(a, 4 << 20) : NULL;
+    report("threadsafe heap gives cached blocks back", p != NULL);
+    if (a) {
+        alloc_free(a, p);
+        alloc_destroy(a);
+    }
+    if (ram)
+        munmap(ram, arena);
+}
+
+static void check_realloc_shrink_purges(void) {
+    // shrinking a block in place hands its upper halves back dirty, but never ran the purge
+    // check a free runs, nor counted the splits and the request
+    const size_t arena = 16 << 20;
+    void *ram = map_arena(arena);
+    alloc_config_t config = {0};
+    config.type = MALLOC_BUDDY;
+    config.memory_size = arena;
+    config.start_of_memory = ram;
+    config.header_size = 8;
+    config.min_mem_chunk_size = 64;
+    config.purge_size = 64 << 10;
+    config.purge_dirty_max = 1 << 20;
+    allocator_t *a = ram ? alloc_create(&config) : NULL;
+    void *p = a ? alloc_malloc(a, 8 << 20) : NULL;
+    malloc_stats_t before, after;
+    if (p)
+        alloc_stats(a, &before);
+    bool ok = p && alloc_realloc(a, p, 100) == p;
+    if (ok) {
+        alloc_stats(a, &after);
+        ok = after.purges > before.purges && after.splits > before.splits &&
+             after.requested_bytes == before.requested_bytes + 100;
+    }
+    report("in place realloc shrink purges and counts", ok);
+    if (a)
+        alloc_destroy(a);
+    if (ram)
+        munmap(ram, arena);
+}
+
+static void check_size_class_alignment(void) {
+    // with 3 classes per power of two the steps used to be 5, 10, ... bytes, so objects of the
+    // slab caches lost their 8 byte alignment
+    const size_t arena = 64 << 20;
+    void *ram = map_arena(arena);
+    alloc_config_t config = {0};
+    config.type = MALLOC_SLAB;
+    config.memory_size = arena;
+    config.start_of_memory = ram;
+    config.header_size = 8;
+    config.min_mem_chunk_size = 64;
+    config.n_objs_per_slab = 16;
+    config.size_class_steps = 3;
+    allocator_t *a = ram ? alloc_create(&config) : NULL;
+    bool ok = a != NULL;
+    for (size_t size = 8; ok && size <= 8192; size += 8) {
+        void *p[2] = {alloc_malloc(a, size), alloc_malloc(a, size)};
+        ok = p[0] && p[1] && ((uintptr_t)p[0] & 7) == 0 && ((uintptr_t)p[1] & 7) == 0;
+    }
+    report("size classes keep 8 byte alignment", ok);
+    if (a)
+        alloc_destroy(a);
+    if (ram)
+        munmap(ram, arena);
+}
+
+static void check_grow_out_of_ids(void) {
+    // exact size slab caches on a growable heap: thousands of distinct sizes run a region out
+    // of cache ids long before its memory, which used to map ever bigger regions (GBs for a
+    // few MB live)
+    enum { SLOTS = 1024 };
+    static void *slots[SLOTS];
+    alloc_config_t config = {0};
+    config.type = MALLOC_SLAB;
+    config.memory_size = 8 << 20;
+    config.header_size = 8;
+    config.min_mem_chunk_size = 64;
+    config.n_objs_per_slab = 4;
+    config.flags = MALLOC_F_GROW;
+    allocator_t *a = alloc_create(&config);
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    bool ok = a != NULL;
+    for (int i = 0; ok && i < 200000; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        void **slot = &slots[rng % SLOTS];
+        alloc_free(a, *slot);
+        *slot = alloc_malloc(a, 1 + (rng >> 32) % 10000);     // about 5 MB live
+    }
+    malloc_stats_t st;
+    if (a)
+        alloc_stats(a, &st);
+    ok = ok && st.memory_size <= ((size_t)1 << 30) && st.slab_meta_failures > 0;
+    if (a)
+        printf("  %d regions, %zu MB mapped, %llu failures out of ids\n", st.regions, st.memory_size >> 20,
+               (unsigned long long)st.slab_meta_failures);
+    report("growable heap out of ids stays small", ok);
+    for (int i = 0; i < SLOTS; i++)
+        slots[i] = NULL;
+    if (a)
+        alloc_destroy(a);
+}
+
+static void check_grow_mixed_sizes(unsigned flags, const char *name) {
+    // sizes from 16 bytes to 192 KB on a growable slab heap with size classes: objects above the
+    // class table got a cache per exact size, the regions ran out of cache ids and the heap
+    // mapped GBs for 100 MB live, then failed requests with most of it free
+    enum { SLOTS = 8192 };
+    static void *slots[SLOTS];
+    static size_t sizes[SLOTS];
+    alloc_config_t config = {0};
+    config.type = MALLOC_SLAB;
+    config.memory_size = 4 << 20;
+    config.header_size = 8;
+    config.min_mem_chunk_size = 64;
+    config.n_objs_per_slab = 16;
+    config.size_class_steps = 4;
+    config.flags = MALLOC_F_GROW | flags;
+    allocator_t *a = alloc_create(&config);
+    uint64_t rng = 88172645463325252ull, fails = 0;
+    size_t live = 0, peak = 0;
+    for (int i = 0; a && i < 500000; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        int k = rng % SLOTS;
+        alloc_free(a, slots[k]);
+        live -= sizes[k];
+        size_t lo = (size_t)1 << (4 + (rng >> 20) % 13);         // about log-uniform
+        sizes[k] = lo + (rng >> 40) % lo / 2;
+        slots[k] = alloc_malloc(a, sizes[k]);
+        if (!slots[k]) {
+            sizes[k] = 0;
+            fails++;
+        }
+        live += sizes[k];
+        peak = live > peak ? live : peak;
+    }
+    malloc_stats_t st;
+    if (a)
+        alloc_stats(a, &st);
+    bool ok = a && fails == 0 && st.memory_size <= 8 * peak;
+    if (a)
+        printf("  %d regions, %zu MB mapped for %zu MB live, %llu failures\n", st.regions, st.memory_size >> 20,
+               peak >> 20, (unsigned long long)fails);
+    report(name, ok);
+    for (int i = 0; i < SLOTS; i++) {
+        slots[i] = NULL;
+        sizes[i] = 0;
+    }
+    if (a)
+        alloc_destroy(a);
+}
+
+// Usage: regress
+int main(void) {
+    check_threadsafe_over_4g();
+    check_threadsafe_cached_blocks();
+    check_realloc_shrink_purges();
+    check_size_class_alignment();
+    check_grow_out_of_ids();
+    check_grow_mixed_sizes(0, "growable heap mapped vs live");
+    check_grow_mixed_sizes(MALLOC_F_THREADSAFE, "threadsafe growable heap mapped vs live");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,133 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+#define MAX_LINE_LEN 1024
+
+// Open a text or binary trace, depending on its first bytes
+bool trace_open(trace_t *t, const char *path) {
+    memset(t, 0, sizeof(*t));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    trace_header_t hdr;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    bool binary = (size_t)st.st_size >= sizeof(hdr) && pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+                  memcmp(hdr.magic, TRACE_MAGIC, 4) == 0;
+    if (!binary) {
+        t->text = fdopen(fd, "r");
+        if (t->text == NULL) {
+            close(fd);
+            return false;
+        }
+        return true;
+    }
+
+    if (hdr.version != TRACE_VERSION || hdr.nrecs > (st.st_size - sizeof(hdr)) / sizeof(trace_rec_t)) {
+        fprintf(stderr, "%s: Bad binary trace header.\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    t->map_len = st.st_size;
+    t->map = mmap(NULL, t->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (t->map == MAP_FAILED)
+        return false;
+    madvise(t->map, t->map_len, MADV_SEQUENTIAL);
+    t->recs = (const trace_rec_t *)((const char *)t->map + sizeof(hdr));
+    t->nrecs = hdr.nrecs;
+    return true;
+}
+
+// Next operation of the trace, false at the end
+bool trace_next(trace_t *t, ops_t *op) {
+    if (t->text)
+        return read_next_op(t->text, op);
+    if (t->next == t->nrecs)
+        return false;
+
+    const trace_rec_t *r = &t->recs[t->next++];
+    op->type = r->type;
+    op->name = r->name;
+    op->numops = r->numops;
+    op->size = r->size;
+    validate_op(op);
+    return true;
+}
+
+void trace_close(trace_t *t) {
+    if (t->text)
+        fclose(t->text);
+    if (t->map)
+        munmap(t->map, t->map_len);
+    memset(t, 0, sizeof(*t));
+}
+
+// Read and parse one line
+bool read_next_op(FILE *fd, ops_t *op) {
+    char line[MAX_LINE_LEN];
+    if (!fgets(line, MAX_LINE_LEN, fd))
+        return false;
+
+    char *token;
+    char delim[2] = " ";
+    char *rest = line;
+
+    token = strtok_r(rest, delim, &rest);
+    if (token)
+        op->name = *token;
+    else
+        goto err;
+
+    token = strtok_r(rest, delim, &rest);
+    if (token)
+        op->numops = atoi(token);
+    else
+        goto err;
+
+    token = strtok_r(rest, delim, &rest);
+    if (token)
+        op->type = *token;
+    else
+        goto err;
+
+    token = strtok_r(rest, delim, &rest);
+    if (token)
+        op->size = atoi(token);
+    // else
+    // 	goto err;
+
+    validate_op(op);
+    return true;
+
+err:
+    fprintf(stderr, "%s: Invalid line in input file.\n", __func__);
+    exit(EXIT_FAILURE);
+}
+
+// Request (input file) validation
+void validate_op(const ops_t *op) {
+    if (op->type != 'M' && op->type != 'F') {
+        fprintf(stderr, "%s: Invalid type in input file.\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    if (op->numops <= 0) {
+        fprintf(stderr, "%s: Invalid number in input file.\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+    if (op->type == 'M' && op->size <= 0) {
+        fprintf(stderr, "%s: Invalid size in input file.\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Allocation traces
+// Text format, one operation per line:
+//   <name> <count> M <size>    allocate count objects of size bytes under handle name
+//   <name> <index> F           free object index (1 based) of handle name
+// Binary format: trace_header_t followed by nrecs trace_rec_t, all little endian. The tester
+// mmaps it and replays the records as they are.
+// A name may be used again for a new 'M' once every object of its previous one is freed.
+// An 'F' for an object its 'M' asked for but did not get (the batch failed before it) frees
+// nothing. The tester logs "Skipped free of object <name> <index>, its allocation failed" for
+// it when the 'M' got some objects, and stays silent when it got none (as it always did for a
+// name without a handle). Any other 'F' for an object that is not live is an error.
+
+// Allocator configuration the tester replays traces with
+#define TRACE_MEMORY_SIZE (8 * 1024 * 1024)
+#define TRACE_HEADER_SIZE 8
+#define TRACE_MIN_MEM_CHUNK_SIZE 512
+#define TRACE_N_OBJS_PER_SLAB 64
+
+#define TRACE_MAGIC "ATRC"
+#define TRACE_VERSION 1
+
+struct ops {
+    char name;  // name
+    int numops; // number of allocation requests OR index
+    char type;  // 'M' OR 'F'
+    int size;   // size of allocation request
+};
+typedef struct ops ops_t;
+
+typedef struct trace_header {
+    char magic[4];     // TRACE_MAGIC
+    uint32_t version;  // TRACE_VERSION
+    uint64_t nrecs;    // number of records after the header
+} trace_header_t;
+
+typedef struct trace_rec {
+    char type;         // 'M' OR 'F'
+    char name;
+    uint16_t reserved; // 0
+    int32_t numops;    // count for 'M', index for 'F'
+    int32_t size;      // 0 for 'F'
+} trace_rec_t;
+
+// An open trace of either format
+struct trace {
+    FILE *text;                // text trace, NULL for a binary one
+    const trace_rec_t *recs;   // binary trace: records in the mapping
+    uint64_t nrecs, next;
+    void *map;
+    size_t map_len;
+};
+typedef struct trace trace_t;
+
+bool trace_open(trace_t *t, const char *path); // sniffs the format; false with errno set on failure
+bool trace_next(trace_t *t, ops_t *op);        // exits on a malformed operation
+void trace_close(trace_t *t);
+
+bool read_next_op(FILE *fd, ops_t *op);
+void validate_op(const ops_t *op);
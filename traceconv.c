@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// Convert a text trace to the binary trace format
+// Usage: traceconv <input_file> <output_file>
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <text_trace> <binary_trace>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL) {
+        perror("fopen() error");
+        exit(EXIT_FAILURE);
+    }
+    FILE *out = fopen(argv[2], "wb");
+    if (out == NULL) {
+        perror("fopen() error");
+        exit(EXIT_FAILURE);
+    }
+
+    // Header first with nrecs 0, patched once the count is known
+    trace_header_t hdr = {.version = TRACE_VERSION};
+    memcpy(hdr.magic, TRACE_MAGIC, 4);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+        goto werr;
+
+    ops_t op = {0};
+    while (read_next_op(in, &op)) {
+        trace_rec_t rec = {
+            .type = op.type,
+            .name = op.name,
+            .numops = op.numops,
+            .size = op.type == 'M' ? op.size : 0,
+        };
+        if (fwrite(&rec, sizeof(rec), 1, out) != 1)
+            goto werr;
+        hdr.nrecs++;
+    }
+
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+        goto werr;
+    if (fclose(out) != 0)
+        goto werr;
+    fclose(in);
+    printf("%s: %llu records written to %s\n", __func__, (unsigned long long)hdr.nrecs, argv[2]);
+    return 0;
+
+werr:
+    perror("fwrite() error");
+    exit(EXIT_FAILURE);
+}
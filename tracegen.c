@@ -0,0 +1,375 @@
+#include <libgen.h>
+#include <math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "api.h"
+#include "trace.h"
+
+// Synthetic trace generator
+// Writes a text trace plus the tester's expected output for buddy, slab, hybrid or all three.
+// The reference allocators run alongside the generator (same configuration as the tester), so
+// the trace only frees objects that really got allocated and the expected files are exact. When
+// the types get different counts for one 'M' line, the objects not all of them got are freed
+// right away: the tester skips an 'F' for an object its batch failed to allocate.
+//
+// Time is counted in allocated objects: an object born at t with lifetime l is freed at t + l,
+// or earlier when the live set would grow past its target. The target is lowered every time a
+// request fails in either allocator, since allocator overhead can make it too high. Names are
+// single characters and only come back once all their objects are freed, so at most
+// NAME_COUNT * max_batch objects are live whatever the target.
+
+#define NAME_FIRST '!'
+#define NAME_LAST '~'
+#define NAME_COUNT (NAME_LAST - NAME_FIRST + 1)
+#define MAX_OBJ_SIZE (1024 * 1024)
+#define TYPES_ALL 3                    // -t value for buddy, slab and hybrid, the tester's types 0-2
+
+enum dist_kind { DIST_FIXED, DIST_UNIFORM, DIST_LOGNORMAL, DIST_BIMODAL, DIST_EXP };
+
+typedef struct dist {
+    enum dist_kind kind;
+    double a, b, p;
+} dist_t;
+
+typedef struct object {
+    uint64_t death;
+    char name;
+    int index;
+    int size;
+} object_t;
+
+// Reference run of one allocator type, mirrors call_my_malloc()/call_my_free() of the tester
+typedef struct ref {
+    allocator_t *heap;
+    void *ram;
+    FILE *out;
+    bool any_handle;       // some 'M' line got memory
+    void **addrs[NAME_COUNT];
+    int got[NAME_COUNT];   // objects the name's last 'M' line got
+} ref_t;
+
+typedef struct name_state {
+    int live;              // objects not freed yet
+} name_state_t;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t next_rand(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+static double rand_unit(void) {
+    return (double)(next_rand() >> 11) / 9007199254740992.0; // [0, 1)
+}
+
+static double rand_normal(void) {
+    double u = rand_unit(), v = rand_unit();
+    return sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * v);
+}
+
+static double sample(const dist_t *d) {
+    switch (d->kind) {
+    case DIST_FIXED:
+        return d->a;
+    case DIST_UNIFORM:
+        return d->a + rand_unit() * (d->b - d->a + 1);
+    case DIST_LOGNORMAL:
+        return exp(d->a + d->b * rand_normal());
+    case DIST_BIMODAL:
+        return rand_unit() < d->p ? d->a : d->b;
+    case DIST_EXP:
+        return -d->a * log(1.0 - rand_unit());
+    }
+    return d->a;
+}
+
+// Parse "kind:x[:y[:z]]"
+static bool parse_dist(const char *arg, dist_t *d) {
+    char kind[16] = {0};
+    double x = 0, y = 0, z = 0;
+    int n = sscanf(arg, "%15[a-z]:%lf:%lf:%lf", kind, &x, &y, &z);
+    if (n >= 2 && strcmp(kind, "fixed") == 0)
+        *d = (dist_t){DIST_FIXED, x, 0, 0};
+    else if (n >= 3 && strcmp(kind, "uniform") == 0 && x <= y)
+        *d = (dist_t){DIST_UNIFORM, x, y, 0};
+    else if (n >= 3 && strcmp(kind, "lognormal") == 0)
+        *d = (dist_t){DIST_LOGNORMAL, x, y, 0};
+    else if (n >= 4 && strcmp(kind, "bimodal") == 0)
+        *d = (dist_t){DIST_BIMODAL, x, y, z};
+    else if (n >= 2 && strcmp(kind, "exp") == 0)
+        *d = (dist_t){DIST_EXP, x, 0, 0};
+    else
+        return false;
+    return true;
+}
+
+// Min-heap of live objects by death time
+static object_t *heap;
+static size_t heap_len, heap_cap;
+
+static void heap_push(object_t o) {
+    if (heap_len == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 1024;
+        heap = realloc(heap, heap_cap * sizeof(object_t));
+        if (heap == NULL) {
+            perror("realloc() error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    size_t i = heap_len++;
+    while (i > 0 && heap[(i - 1) / 2].death > o.death) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = o;
+}
+
+static object_t heap_pop(void) {
+    object_t top = heap[0];
+    object_t last = heap[--heap_len];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= heap_len)
+            break;
+        if (c + 1 < heap_len && heap[c + 1].death < heap[c].death)
+            c++;
+        if (heap[c].death >= last.death)
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+static void ref_open(ref_t *r, enum malloc_type type, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->ram = malloc(TRACE_MEMORY_SIZE);
+    r->out = fopen(path, "w");
+    if (r->ram == NULL || r->out == NULL) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    alloc_config_t config = {
+        .type = type,
+        .memory_size = TRACE_MEMORY_SIZE,
+        .start_of_memory = r->ram,
+        .header_size = TRACE_HEADER_SIZE,
+        .min_mem_chunk_size = TRACE_MIN_MEM_CHUNK_SIZE,
+        .n_objs_per_slab = TRACE_N_OBJS_PER_SLAB,
+    };
+    r->heap = alloc_create(&config);
+    if (r->heap == NULL) {
+        fprintf(stderr, "alloc_create() failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void ref_close(ref_t *r) {
+    alloc_destroy(r->heap);
+    for (int i = 0; i < NAME_COUNT; i++)
+        free(r->addrs[i]);
+    fclose(r->out);
+    free(r->ram);
+}
+
+static int ref_malloc(ref_t *r, char name, int count, int size) {
+    int slot = name - NAME_FIRST;
+    free(r->addrs[slot]);
+    r->addrs[slot] = malloc(sizeof(void *) * (count + 1));
+    if (r->addrs[slot] == NULL) {
+        perror("malloc() error");
+        exit(EXIT_FAILURE);
+    }
+    int got = alloc_malloc_batch(r->heap, size, count, r->addrs[slot] + 1);
+    r->got[slot] = got;
+    for (int i = 1; i <= got; i++)
+        fprintf(r->out, "Start of %sChunk %c is: %d\n", r->any_handle ? "" : "first ", name,
+                (int)((char *)r->addrs[slot][i] - (char *)r->ram));
+    if (got < count)
+        fprintf(r->out, "Allocation Error %c\n", name);
+    if (got > 0)
+        r->any_handle = true;
+    return got;
+}
+
+static void ref_free(ref_t *r, char name, int index) {
+    int got = r->got[name - NAME_FIRST];
+    if (index > got) {
+        if (got > 0)    // as the tester logs it
+            fprintf(r->out, "Skipped free of object %c %d, its allocation failed\n", name, index);
+        return;
+    }
+    void *p = r->addrs[name - NAME_FIRST][index];
+    alloc_free(r->heap, p);
+    fprintf(r->out, "freed object %c at %d\n", name, (int)((char *)p - (char *)r->ram));
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <output_trace>\n", prog);
+    fprintf(stderr, "  -n ops        total malloc+free operations (default 100000)\n");
+    fprintf(stderr, "  -s dist       object size: fixed:N, uniform:MIN:MAX, lognormal:MU:SIGMA,\n");
+    fprintf(stderr, "                bimodal:SMALL:LARGE:P_SMALL (default lognormal:5:1.5)\n");
+    fprintf(stderr, "  -l dist       lifetime in allocations: fixed:N, uniform:MIN:MAX, exp:MEAN (default exp:1000)\n");
+    fprintf(stderr, "  -L bytes      live set target, at most 94 * max batch objects get live (default 4194304)\n");
+    fprintf(stderr, "  -b count      max objects per 'M' line (default 16)\n");
+    fprintf(stderr, "  -r seed       random seed\n");
+    fprintf(stderr, "  -t type       reference allocator, as the tester's: 0 buddy, 1 slab, 2 hybrid, 3 all (default 3)\n");
+    fprintf(stderr, "  -e dir        directory for the expected outputs (default: next to the trace)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t total_ops = 100000;
+    dist_t size_dist = {DIST_LOGNORMAL, 5, 1.5, 0};
+    dist_t life_dist = {DIST_EXP, 1000, 0, 0};
+    uint64_t live_target = 4 * 1024 * 1024;
+    int max_batch = 16;
+    const char *expected_dir = NULL;
+    int ref_type = TYPES_ALL;
+
+    int i;
+    for (i = 1; i < argc - 1; i += 2) {
+        const char *v = argv[i + 1];
+        if (strcmp(argv[i], "-n") == 0)
+            total_ops = strtoull(v, NULL, 10);
+        else if (strcmp(argv[i], "-s") == 0) {
+            if (!parse_dist(v, &size_dist))
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-l") == 0) {
+            if (!parse_dist(v, &life_dist))
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-L") == 0)
+            live_target = strtoull(v, NULL, 10);
+        else if (strcmp(argv[i], "-b") == 0)
+            max_batch = atoi(v);
+        else if (strcmp(argv[i], "-r") == 0)
+            rng_state = strtoull(v, NULL, 10) * 0x2545F4914F6CDD1Dull + 1;
+        else if (strcmp(argv[i], "-e") == 0)
+            expected_dir = v;
+        else if (strcmp(argv[i], "-t") == 0)
+            ref_type = atoi(v);
+        else
+            usage(argv[0]);
+    }
+    if (i != argc - 1 || total_ops == 0 || max_batch <= 0 || ref_type < 0 || ref_type > TYPES_ALL)
+        usage(argv[0]);
+    const char *trace_path = argv[argc - 1];
+
+    FILE *trace = fopen(trace_path, "w");
+    if (trace == NULL) {
+        perror("fopen() error");
+        exit(EXIT_FAILURE);
+    }
+
+    // Expected outputs, named like the tester's output files
+    char path_copy[512], base_copy[512], expected[TYPES_ALL][1024];
+    snprintf(path_copy, sizeof(path_copy), "%s", trace_path);
+    snprintf(base_copy, sizeof(base_copy), "%s", trace_path);
+    const char *dir = expected_dir ? expected_dir : dirname(path_copy);
+    ref_t refs[TYPES_ALL];
+    int nrefs = ref_type == TYPES_ALL ? TYPES_ALL : 1;
+    for (int t = 0; t < nrefs; t++) {
+        int type = ref_type == TYPES_ALL ? t : ref_type;
+        snprintf(expected[t], sizeof(expected[t]), "%s/result-%d-%s", dir, type, basename(base_copy));
+        ref_open(&refs[t], type, expected[t]);
+    }
+    uint64_t live_floor = live_target / 4;
+
+    name_state_t names[NAME_COUNT] = {0};
+    uint64_t now = 0, ops = 0, live_bytes = 0, errors = 0, name_waits = 0;
+    int next_name = 0;
+
+    while (ops < total_ops || heap_len > 0) {
+        bool draining = ops >= total_ops;
+
+        // Free what is due, or the oldest-dying object while over the live set target
+        if (heap_len > 0 && (draining || heap[0].death <= now || live_bytes > live_target)) {
+            object_t o = heap_pop();
+            fprintf(trace, "%c %d F\n", o.name, o.index);
+            for (int t = 0; t < nrefs; t++)
+                ref_free(&refs[t], o.name, o.index);
+            names[o.name - NAME_FIRST].live--;
+            live_bytes -= o.size;
+            ops++;
+            continue;
+        }
+
+        // Next name whose previous handle is fully freed
+        int slot = -1;
+        for (int k = 0; k < NAME_COUNT; k++) {
+            int s = (next_name + k) % NAME_COUNT;
+            if (names[s].live == 0) {
+                slot = s;
+                break;
+            }
+        }
+        if (slot < 0) {
+            now = heap[0].death;    // every name has live objects, so the heap is not empty
+            name_waits++;
+            continue;
+        }
+        next_name = (slot + 1) % NAME_COUNT;
+
+        char name = (char)(NAME_FIRST + slot);
+        int count = 1 + (int)(next_rand() % (uint64_t)max_batch);
+        double sz = sample(&size_dist);
+        int size = sz < 1 ? 1 : sz > MAX_OBJ_SIZE ? MAX_OBJ_SIZE : (int)sz;
+        fprintf(trace, "%c %d M %d\n", name, count, size);
+
+        int got = count, got_max = 0;
+        for (int t = 0; t < nrefs; t++) {
+            int n = ref_malloc(&refs[t], name, count, size);
+            got = n < got ? n : got;
+            got_max = n > got_max ? n : got_max;
+        }
+        if (got < count) {
+            errors++;
+            uint64_t lower = live_bytes - live_bytes / 8;
+            if (lower < live_target)
+                live_target = lower > live_floor ? lower : live_floor;
+        }
+        for (int k = got + 1; k <= got_max; k++) {
+            // not every run got it, free it now so the name can come back
+            fprintf(trace, "%c %d F\n", name, k);
+            for (int t = 0; t < nrefs; t++)
+                ref_free(&refs[t], name, k);
+            ops++;
+        }
+
+        for (int k = 1; k <= got; k++) {
+            double life = sample(&life_dist);
+            heap_push((object_t){now + k + (uint64_t)(life < 0 ? 0 : life), name, k, size});
+        }
+        names[slot].live += got;
+        live_bytes += (uint64_t)got * size;
+        now += count;
+        ops += got + (got < count);    // a failed request still counts as one operation
+    }
+
+    fclose(trace);
+    for (int t = 0; t < nrefs; t++)
+        ref_close(&refs[t]);
+    free(heap);
+
+    printf("%s: %llu operations, %llu allocation errors, final live set target %llu\n", __func__,
+           (unsigned long long)ops, (unsigned long long)errors, (unsigned long long)live_target);
+    if (name_waits)
+        printf("%s: waited %llu times for a free name, the live set was capped below the target (raise -b)\n",
+               __func__, (unsigned long long)name_waits);
+    printf("%s: trace %s, expected", __func__, trace_path);
+    for (int t = 0; t < nrefs; t++)
+        printf("%s %s", t == 0 ? "" : t == nrefs - 1 ? " and" : ",", expected[t]);
+    printf("\n");
+    return 0;
+}